@@ -4,7 +4,10 @@
 #include <LittleFS.h>
 #include <WiFiManager.h>
 #include "StringStream.h"
-#include <RingBuf.h>
+#include "SpscRing.h"
+#include "LineFramer.h"
+#include "SmuffStatus.h"
+#include "LatencyHistogram.h"
 #if defined(ESP32)
 #include <BluetoothSerial.h>
 #else
@@ -33,9 +36,47 @@
 #define LED_PIN         14  // D5
 #define NPX_PIN         14  // D5
 #endif
+//#define LOG_UART1   1   // uncomment (or add -D LOG_UART1 to build_flags) to send debug/log output to UART1 (TX only, GPIO2/D4) instead of the spare UART (ESP8266 only)
+#define LOG_BAUDRATE    115200  // baudrate of UART1 for debug/log output
+#if defined(LOG_UART1) && !defined(ESP32)
+#define INTLED_PIN      -1  // GPIO2 is the TX of UART1 (debug output), no built in LED then
+#else
 #define INTLED_PIN      2   // GPIO2 - built in LED (D4)
+#endif
 #define BAUDRATE        115200
 #define BAUDRATE2       19200
+#define UART_RX_BUFSIZE 256     // size of the interrupt driven receive buffer of the spare UART
+#define SMUFF_PORT      1       // serial port number of the SMuFF the WI-ESP is connected to (for M575)
+#define CHUNK_SIZE      250     // max. number of bytes sent at one go over web-socket
+#define SMUFF_RX_BUFSIZE 2048   // size of the ISR driven receive buffer of the SMuFF UART
+#define BRIDGE_BUFSIZE  2048    // size of the SMuFF to WebSocket ring buffer (must be a power of two)
+#define FLOW_HIGH_WATER (BRIDGE_BUFSIZE*3/4)    // pause the SMuFF above this fill level...
+#define FLOW_LOW_WATER  (BRIDGE_BUFSIZE/4)      // ...and let it resume below this one
+#define XON             0x11
+#define XOFF            0x13
+//#define RTS_PIN         4       // uncomment if the SMuFF's CTS line is wired to this GPIO (active low)
+#if defined(ESP32)
+#define BRIDGE_TASK_CORE    0       // loop() and with it the web server run on ARDUINO_RUNNING_CORE (1)
+#define BRIDGE_TASK_PRIO    3
+#define BRIDGE_TASK_STACK   4096
+#define BRIDGE_TASK_POLL    2       // ms
+#define BRIDGE_QUEUE_LEN    16      // lines buffered between bridge task and loop()
+#endif
+
+#define SCRIPT_DIR      "/scripts"  // command files uploaded via /uploadScript
+
+#define CAPTURE_FILE    "/capture.bin"
+#define CAPTURE_VERSION 1
+#define CAP_RX          0           // capture record direction: SMuFF -> WI-ESP
+#define CAP_TX          1           // WI-ESP -> SMuFF
+#define CMDQ_MAX_WINDOW 16          // max. number of commands in flight
+#define WS_BROADCAST    -1          // replyClient for output which goes to all WebSocket clients
+#define TCP_BRIDGE_PORT 2323        // raw access to the SMuFF's serial stream
+#define TCP_ISSUER      100         // issuer of commands received over TCP (see queueCommands())
+#define BT_ISSUER       101         // issuer of commands received over Bluetooth
+//#define LOOP_PROFILER   1           // uncomment to measure the stages of loop() (see WI-CMD:SYS:PROF)
+#include "LoopProfiler.h"
+#include "Scheduler.h"
 
 #define DEFAULT_NUMLEDS 4
 #define PULSE_BPM       20
@@ -45,6 +86,27 @@
 #define MIME_JSON       "text/json"
 #define MIME_HTML       "text/html"
 #define MIME_TEXT       "text/plain"
+#define MIME_BINARY     "application/octet-stream"
+#define MIME_METRICS    "text/plain; version=0.0.4"
+
+typedef enum {
+  FLOW_OFF      = 0,
+  FLOW_XONXOFF,
+  FLOW_RTS
+} FlowControl;
+
+typedef struct __attribute__((packed)) {
+  char          magic[4];       // "SMCP"
+  uint16_t      version;        // CAPTURE_VERSION
+  uint16_t      flags;          // reserved
+} CaptureHeader;
+
+typedef struct __attribute__((packed)) {
+  uint32_t      micros;         // timestamp
+  uint8_t       dir;            // CAP_RX or CAP_TX
+  uint8_t       flags;          // reserved
+  uint16_t      len;            // bytes following
+} CaptureRecord;
 
 extern WiFiManager      wifiMgr;
 extern int              wifiBtn;
@@ -59,13 +121,48 @@ extern HardwareSerial   SerialUART;
 extern EspSoftwareSerial::UART SerialUART;
 #endif
 extern StringStream     debugOut;
-extern RingBuf<byte, 2048> bufFromSMuFF;
+typedef SpscRing<byte, BRIDGE_BUFSIZE> BridgeRing;
+
+extern BridgeRing       bufFromSMuFF;
+extern LineFramer<BridgeRing, CHUNK_SIZE> framerSMuFF;
+extern SmuffStatus      statusSMuFF;
 extern unsigned long    smuffSent, wiSent, btSent;
+extern volatile unsigned long rxOverruns, rxErrors, rxDropped, rxBytes;
+extern volatile unsigned long txBytes;
+extern unsigned long    loopIterations, loopRate;
+extern Scheduler        scheduler;
+extern int              tcpClientsConnected;
+extern unsigned long    tcpRxBytes, tcpTxBytes, tcpDropped;
+extern unsigned long    uartRxBytes, uartRxLines, uartRxOverflows, uartRxDropped;
+extern unsigned long    logQueued, logDropped, logDroppedBytes, logWritten;
+extern unsigned long    baudRate, rxRate, rxRatePeak;
+extern uint16_t         wsBatchBudget, wsBatchLimit;
+extern unsigned long    wsMessages, wsFrames, wsBytes, wsMessageRate, wsFrameRate;
+extern int              replyClient;
+extern unsigned long    wsBinaryRecords, wsBinarySaved;
+extern unsigned long    infoProbes, infoCacheHits;
+extern volatile bool    captureOn;
+extern bool             captureToFile;
+extern unsigned long    capRecords, capBytes, capLost, capOverwritten;
+extern LatencyHistogram latDispatch, latSend;
+extern uint32_t         lineArrived;
+extern bool             latStamps;
+extern unsigned long    latMarksLost;
+extern uint8_t          cmdWindow, cmdInFlight, cmdInFlightMax;
+extern unsigned int     cmdPending;
+extern unsigned long    cmdAcked, cmdTimeouts, cmdHeld, cmdDropped;
+extern bool             cmdChecksum;
+extern uint32_t         cmdLine;
+extern unsigned long    cmdResent, cmdResendFailed;
+extern FlowControl      flowControl;
+extern bool             flowLossless;
+extern uint16_t         flowHighWater, flowLowWater;
+extern bool             flowPaused;
+extern unsigned long    flowPauses, flowPausedMs, rxOverflows;
 extern int              btConnections;
 extern bool             debugToUART;
 extern bool             logToUART;
 extern bool             debugMemInfo;
-extern bool             isPinging;
 extern int              numLeds;
 extern Adafruit_NeoPixel*  neoPixels;
 extern bool             isPulsing;
@@ -91,7 +188,36 @@ typedef enum {
 extern void initWebserver();
 extern void initWebsockets();
 extern void sendToWebsocket(String& data);
+extern void sendToWebsocket(const char* data, size_t len);
+extern void sendStatusToWebsocket(const char* line, size_t len);
+extern void setBinaryStatus(bool on);
+extern int getWebsocketClientStats(char* buf, size_t len);
+extern void flushWebsocket();
+extern void setWebsocketBatching(uint16_t budget, uint16_t limit);
 extern void loopWebserver();
+extern void loopWifiManager();
+extern void initScheduler();
+extern void initTcpBridge();
+extern void loopTcpBridge();
+extern void tcpBridgeData(const char* data, size_t len);
+extern bool canWriteTcp(WiFiClient& client, size_t len);
+extern int getTcpStats(char* buf, size_t len);
+extern void loopUartReceive();
+extern int getUartStats(char* buf, size_t len);
+extern void initLog();
+extern void logWrite(const char* msg, bool newline);
+extern void loopLog();
+extern void flushLog();
+extern int getLogStats(char* buf, size_t len);
+extern void setUartSubscription(bool on);
+extern int getUartSubscribers();
+extern void sendUartToWebsocket(const char* line, size_t len);
+#if defined(ESP32)
+extern void serialUartError(hardwareSerial_error_t err);
+#endif
+#if !defined(ESP32)
+extern void loopMDNS();
+#endif
 extern void initDisplay();
 extern void resetDisplay();
 extern void drawIPAddress(const char* buf);
@@ -106,4 +232,63 @@ extern void initNeoPixels();
 extern void setNeoPixelPulsing();
 extern void setNeoPixelPulsing(int num);
 extern void serialSmuffEvent();
-extern void getStringFromBuffer(String& ref);
+extern bool setFlowControl(FlowControl mode);
+extern void sendResponse(const char* fmt, ...);
+extern void initBaudrate();
+extern void loopBaudrate();
+extern bool startBaudSwitch(unsigned long rate, int port);
+extern bool isBaudSwitching();
+extern bool baudrateLine(const char* line, size_t len);
+extern void initSmuffInfo();
+extern void loopSmuffInfo();
+extern void requestSmuffInfo();
+extern void getSmuffInfo(char* buf, size_t len);
+extern bool smuffInfoLine(const char* line, size_t len);
+extern bool isInfoProbing();
+extern void queueCommands(const char* data, size_t len, int issuer = WS_BROADCAST);
+extern int commandIssuer(const char* line, size_t len);
+extern void commandQueueLine(const char* line, size_t len);
+extern bool setChecksum(bool on);
+extern void setCommandWindow(uint8_t window);
+extern void loopCmdQueue();
+extern bool runScript(const char* name);
+extern bool pauseScript(bool pause);
+extern bool abortScript();
+extern bool isScriptRunning();
+extern void getScriptState(char* buf, size_t len);
+extern void loopScript();
+extern size_t writeToSmuff(const uint8_t* data, size_t len);
+extern size_t writeToSmuff(const char* data);
+extern void captureData(uint8_t dir, const uint8_t* data, size_t len);
+extern bool startCapture(bool toFile);
+extern void stopCapture();
+extern void clearCapture();
+extern size_t pauseCapture(bool& wasOn);
+extern void resumeCapture(bool wasOn);
+extern size_t readCapture(size_t offset, uint8_t* data, size_t len);
+extern void loopCapture();
+extern bool startReplay(uint16_t speed);
+extern void stopReplay();
+extern void getReplayState(char* buf, size_t len);
+extern void loopReplay();
+extern void markArrival(size_t len);
+extern uint32_t lineArrival(size_t len);
+extern void addLatency(LatencyHistogram& hist, uint32_t arrived);
+extern void resetLatency();
+extern int getLatencyStats(char* buf, size_t len);
+extern int getLatencyJson(char* buf, size_t len);
+extern void lockBridge();
+extern void unlockBridge();
+#if defined(ESP32)
+extern void startBridgeTask();
+extern unsigned int getBridgeQueueDepth();
+extern unsigned long bridgeQueueFull;
+#if !defined(NOBT)
+extern unsigned long btTxBytes, btRxBytes, btRxLines, btTxDropped;
+extern void startBtBridge();
+extern void btBridgeData(const uint8_t* data, size_t len);
+extern void loopBtCommands();
+extern int getBtStats(char* buf, size_t len);
+extern unsigned int getBtQueueDepth();
+#endif
+#endif
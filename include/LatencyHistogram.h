@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Latency histogram with fixed, logarithmic buckets: bucket 0 counts
+ * samples below the first limit (LAT_FIRST_BUCKET µs by default), each
+ * following bucket doubles the limit, the last one takes everything
+ * above. Percentiles are reported as the upper limit of the bucket they
+ * fall into, the maximum is exact.
+ * Adding a sample takes a few shifts only, hence it can be done per line.
+ */
+
+#define LAT_BUCKETS         16
+#define LAT_FIRST_BUCKET    64      // µs; the last bucket starts at ~1 s
+
+class LatencyHistogram {
+
+public:
+    uint32_t        buckets[LAT_BUCKETS];
+    uint32_t        count;
+    uint32_t        max;
+    uint64_t        sum;
+    uint32_t        first;
+
+    LatencyHistogram(uint32_t first = LAT_FIRST_BUCKET) : first(first) {
+        reset();
+    }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        max = 0;
+        sum = 0;
+    }
+
+    uint32_t limit(uint8_t bucket) const {
+        return first << bucket;
+    }
+
+    void add(uint32_t us) {
+        uint8_t bucket = 0;
+        while(bucket < LAT_BUCKETS-1 && us >= limit(bucket))
+            bucket++;
+        buckets[bucket]++;
+        count++;
+        sum += us;
+        if(us > max)
+            max = us;
+    }
+
+    /*
+     * Returns the upper limit of the bucket the given percentile falls
+     * into (or max, if that's lower).
+     */
+    uint32_t percentile(uint8_t pct) const {
+        if(count == 0)
+            return 0;
+        uint32_t rank = (uint32_t)(((uint64_t)count * pct + 99) / 100);
+        uint32_t seen = 0;
+        for(uint8_t bucket = 0; bucket < LAT_BUCKETS; bucket++) {
+            seen += buckets[bucket];
+            if(seen >= rank)
+                return bucket < LAT_BUCKETS-1 && limit(bucket) < max ? limit(bucket) : max;
+        }
+        return max;
+    }
+
+    uint32_t average() const {
+        return count > 0 ? (uint32_t)(sum / count) : 0;
+    }
+};
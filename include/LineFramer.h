@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Locates complete lines directly inside a ring buffer, without popping
+ * the bytes into a String first. Lines longer than MaxLen are handed out
+ * in chunks of MaxLen bytes (without the newline).
+ *
+ * The buffer type must provide size(), operator[], peek() and commit()
+ * (see SpscRing.h). Frames which don't wrap around the end of the ring
+ * are handed out in place, only wrapped ones get copied.
+ */
+template<class T, size_t MaxLen>
+class LineFramer {
+
+private:
+    size_t      scanPos = 0;                // bytes already checked for a newline
+    size_t      pending = 0;                // length of the frame handed out by next()
+    char        line[MaxLen+1];
+
+    // what fits into a String without a heap buffer (SSO on the ESP8266)
+    static const size_t StringInline = 11;
+
+public:
+    unsigned long lines = 0;                // complete lines framed
+    unsigned long chunks = 0;               // partial lines sent because of MaxLen
+    unsigned long bytes = 0;                // bytes which bypassed String::concat()
+    unsigned long copied = 0;               // frames copied because they wrapped around
+    unsigned long allocsAvoided = 0;        // String (re)allocations the old dumpBuffer() would have done
+
+    void reset() {
+        scanPos = 0;
+        pending = 0;
+    }
+
+    /*
+     * Returns the length of the next frame (including the newline, if any)
+     * or 0 if there's no complete line in the buffer yet.
+     */
+    size_t scan(T& buffer) {
+        size_t avail = buffer.size();
+        if(scanPos > avail)
+            scanPos = 0;
+        while(scanPos < avail && scanPos < MaxLen) {
+            if(buffer[scanPos++] == '\n') {
+                size_t len = scanPos;
+                scanPos = 0;
+                return len;
+            }
+        }
+        if(scanPos >= MaxLen) {
+            scanPos = 0;
+            return MaxLen;
+        }
+        return 0;
+    }
+
+    /*
+     * Returns the next frame of len bytes (as returned by scan()).
+     * The data stays valid until release() gets called.
+     */
+    const char* next(T& buffer, size_t len) {
+        typename T::Span span = buffer.peek();
+        const char* data;
+        if(span.len >= len) {
+            data = (const char*)span.data;
+        }
+        else {
+            memcpy(line, span.data, span.len);
+            for(size_t n = span.len; n < len; n++)
+                line[n] = (char)buffer[n];
+            line[len] = 0;
+            data = line;
+            copied++;
+        }
+        pending = len;
+        bytes += len;
+        // the old path appended byte by byte and the String grew (realloc)
+        // on each one beyond the inline buffer
+        if(len > StringInline)
+            allocsAvoided += len - StringInline;
+        if(data[len-1] == '\n') {
+            lines++;
+        }
+        else {
+            chunks++;
+            allocsAvoided++;                // substring() for the remainder
+        }
+        return data;
+    }
+
+    /*
+     * Removes the frame handed out by next() from the buffer.
+     */
+    void release(T& buffer) {
+        buffer.commit(pending);
+        pending = 0;
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LatencyHistogram.h"
+
+/*
+ * Measures the time spent in each stage of loop() using the CPU cycle
+ * counter. Only compiled in if LOOP_PROFILER is defined (see Config.h);
+ * otherwise the PROFILE_ macros expand to nothing.
+ *
+ *   PROFILE_BEGIN();                   // at the top of loop()
+ *   ...
+ *   PROFILE_STAGE(PROF_WEBSERVER);     // after each stage
+ */
+
+typedef enum {
+    PROF_SERIAL = 0,                    // draining the UART (ESP8266 only, the bridge task does it on ESP32)
+    PROF_DISPATCH,                      // framing and dispatching lines, WebSocket output
+    PROF_WEBSERVER,                     // HTTP and WebSocket server, WiFiManager, mDNS
+    PROF_HOUSEKEEPING,                  // baudrate, SMuFF info, command queue, scripts, capture, replay
+    PROF_HEAP,                          // heap printout
+    PROF_PIXELS,                        // NeoPixel refresh
+    PROF_STAGES
+} ProfilerStage;
+
+#define PROF_FIRST_BUCKET   4           // µs; the last bucket starts at ~65 ms
+#define PROF_LINE_LEN       150         // max. length of a line of print()
+
+class LoopProfiler {
+
+public:
+    typedef struct {
+        uint32_t            minCycles;
+        uint32_t            maxCycles;
+        uint64_t            sumCycles;
+        LatencyHistogram    hist { PROF_FIRST_BUCKET };
+    } Stage;
+
+    Stage       stages[PROF_STAGES];
+    uint32_t    cyclesPerUs = 80;
+
+    LoopProfiler() {
+        reset();
+    }
+
+    void reset() {
+        for(uint8_t i = 0; i < PROF_STAGES; i++) {
+            stages[i].minCycles = UINT32_MAX;
+            stages[i].maxCycles = 0;
+            stages[i].sumCycles = 0;
+            stages[i].hist.reset();
+        }
+        cyclesPerUs = ESP.getCpuFreqMHz();
+    }
+
+    /*
+     * Accounts the cycles since start to the stage and returns the
+     * current cycle count as start of the next stage.
+     */
+    uint32_t mark(ProfilerStage stage, uint32_t start) {
+        uint32_t now = ESP.getCycleCount();
+        uint32_t cycles = now - start;
+        Stage& st = stages[stage];
+        if(cycles < st.minCycles)
+            st.minCycles = cycles;
+        if(cycles > st.maxCycles)
+            st.maxCycles = cycles;
+        st.sumCycles += cycles;
+        st.hist.add(cycles / cyclesPerUs);
+        return ESP.getCycleCount();     // don't account for the bookkeeping
+    }
+
+    /*
+     * One line per stage, PROF_LINE_LEN at most. Returns the length
+     * snprintf() reports, which is more than len if the text got truncated.
+     */
+    int print(char* buf, size_t len) {
+        static const char* names[] = { "Serial", "Dispatch", "Webserver", "Housekeep", "Heap", "Pixels" };
+        int n = 0;
+        for(uint8_t i = 0; i < PROF_STAGES && n < (int)len; i++) {
+            Stage& st = stages[i];
+            if(st.hist.count == 0)
+                continue;
+            n += snprintf_P(buf+n, len-n, PSTR("%s:\t%lu runs, min. %lu, avg. %lu, max. %lu cycles (p50 %lu us, p99 %lu us, max. %lu us)\n"),
+                names[i],
+                (unsigned long)st.hist.count,
+                (unsigned long)st.minCycles,
+                (unsigned long)(st.sumCycles / st.hist.count),
+                (unsigned long)st.maxCycles,
+                (unsigned long)st.hist.percentile(50),
+                (unsigned long)st.hist.percentile(99),
+                (unsigned long)st.hist.max);
+        }
+        return n;
+    }
+};
+
+#if defined(LOOP_PROFILER)
+extern LoopProfiler loopProfiler;
+#define PROFILE_BEGIN()         uint32_t __profStart = ESP.getCycleCount()
+#define PROFILE_STAGE(stage)    __profStart = loopProfiler.mark(stage, __profStart)
+#else
+#define PROFILE_BEGIN()
+#define PROFILE_STAGE(stage)
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LoopProfiler.h"
+
+/*
+ * Cooperative scheduler for the housekeeping done in loop().
+ * Each task has a period (0 = on every pass) and a priority; on each pass
+ * all tasks which are due run in priority order, and the serial bridge
+ * gets polled before each one of them, hence it never waits for more
+ * than a single task.
+ * A task which starts later than one period after it was due has missed
+ * its deadline; in that case it's rescheduled from now on, instead of
+ * running several times in a row to catch up. The delay between due
+ * and actual start is recorded as jitter.
+ */
+
+#define SCHED_MAX_TASKS     12
+#define SCHED_LINE_LEN      160     // max. length of a line of print(), for task names of up to 15 characters
+
+typedef void (*TaskFunc)();
+
+typedef struct {
+    const char*     name;
+    TaskFunc        func;
+    uint32_t        period;             // ms
+    uint8_t         priority;           // lower value runs first
+    ProfilerStage   stage;              // accounted to this loop() stage by the profiler
+    uint32_t        due;                // micros()
+    unsigned long   runs;
+    unsigned long   misses;
+    uint32_t        jitterMax;          // µs
+    uint64_t        jitterSum;
+    uint32_t        runMax;             // µs
+    uint64_t        runSum;
+} SchedTask;
+
+class Scheduler {
+
+private:
+    SchedTask   tasks[SCHED_MAX_TASKS];
+    uint8_t     count = 0;
+
+public:
+    /*
+     * Adds a task; tasks have to be added by priority.
+     */
+    bool add(const char* name, TaskFunc func, uint32_t period, uint8_t priority, ProfilerStage stage) {
+        if(count >= SCHED_MAX_TASKS)
+            return false;
+        uint8_t pos = count;
+        while(pos > 0 && tasks[pos-1].priority > priority) {
+            tasks[pos] = tasks[pos-1];
+            pos--;
+        }
+        SchedTask& task = tasks[pos];
+        memset(&task, 0, sizeof(task));
+        task.name = name;
+        task.func = func;
+        task.period = period;
+        task.priority = priority;
+        task.stage = stage;
+        task.due = micros();
+        count++;
+        return true;
+    }
+
+    void reset() {
+        for(uint8_t i = 0; i < count; i++) {
+            SchedTask& task = tasks[i];
+            task.runs = task.misses = 0;
+            task.jitterMax = task.runMax = 0;
+            task.jitterSum = task.runSum = 0;
+        }
+    }
+
+    /*
+     * Runs the tasks due, calling poll() before each of them.
+     */
+    void run(TaskFunc poll) {
+        for(uint8_t i = 0; i < count; i++) {
+            SchedTask& task = tasks[i];
+            uint32_t now = micros();
+            if((int32_t)(now - task.due) < 0)
+                continue;
+            if(poll != nullptr) {
+                poll();
+                now = micros();
+            }
+            uint32_t late = now - task.due;
+            uint32_t period = task.period * 1000;
+            PROFILE_BEGIN();
+            task.func();
+            PROFILE_STAGE(task.stage);
+            uint32_t took = micros() - now;
+            task.runs++;
+            task.jitterSum += late;
+            if(late > task.jitterMax)
+                task.jitterMax = late;
+            task.runSum += took;
+            if(took > task.runMax)
+                task.runMax = took;
+            if(period > 0 && late > period) {
+                task.misses++;
+                task.due = now + period;
+            }
+            else
+                task.due += period > 0 ? period : late;
+        }
+    }
+
+    /*
+     * One line per task, SCHED_LINE_LEN at most. Returns the length
+     * snprintf() reports, which is more than len if the text got truncated.
+     */
+    int print(char* buf, size_t len) {
+        int n = 0;
+        for(uint8_t i = 0; i < count && n < (int)len; i++) {
+            SchedTask& task = tasks[i];
+            n += snprintf_P(buf+n, len-n, PSTR("%s:\t%lu ms, prio %u, %lu runs, %lu missed, jitter avg. %lu max. %lu us, run avg. %lu max. %lu us\n"),
+                task.name,
+                (unsigned long)task.period,
+                task.priority,
+                task.runs,
+                task.misses,
+                task.runs > 0 ? (unsigned long)(task.jitterSum / task.runs) : 0,
+                (unsigned long)task.jitterMax,
+                task.runs > 0 ? (unsigned long)(task.runSum / task.runs) : 0,
+                (unsigned long)task.runMax);
+        }
+        return n;
+    }
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Keeps track of the SMuFF's state by watching the lines it sends.
+ * The periodic status report (M155), i.e.
+ *
+ *   echo: states: T: 2 S: on R: off F: on F2: off SD: off SC: off LID: off I: on SPL: 1 RLY: EXT TMP1: 243 HUM1: 412 ...
+ *
+ * gets parsed into a fixed layout, which can be sent as a compact binary
+ * record instead of the text (see "Binary status records" in wi-control.md).
+ * Besides that, the firmware version (M115), the last error and resets
+ * of the SMuFF are recorded.
+ */
+
+#define STATUS_MAGIC        0x53    // 'S'
+#define STATUS_VERSION      1
+#define STATUS_NO_VALUE     -32768  // field wasn't part of the report
+#define STATUS_TEXT_LEN     64
+
+typedef enum {
+    ST_SELECTOR     = 0x0001,       // S:
+    ST_REVOLVER     = 0x0002,       // R:
+    ST_FEEDER       = 0x0004,       // F:
+    ST_FEEDER2      = 0x0008,       // F2:
+    ST_SDCARD       = 0x0010,       // SD:
+    ST_SETTINGS     = 0x0020,       // SC: (settings changed)
+    ST_LID          = 0x0040,       // LID:
+    ST_IDLE         = 0x0080,       // I:
+    ST_RELAY_EXT    = 0x0100,       // RLY: EXT
+    ST_HEATER_ON    = 0x0200        // HON:
+} StatusFlags;
+
+typedef struct __attribute__((packed)) {
+    uint8_t     magic;              // STATUS_MAGIC
+    uint8_t     version;            // STATUS_VERSION
+    int8_t      tool;               // T:, -1 = none
+    int8_t      spool;              // SPL:
+    uint16_t    flags;              // StatusFlags
+    int16_t     temp1;              // TMP1: (1/10 °C)
+    int16_t     temp2;              // TMP2:
+    int16_t     hum1;               // HUM1: (1/10 %)
+    int16_t     hum2;               // HUM2:
+    int16_t     heater1;            // HT1: (1/10 °C)
+    int16_t     heater1Target;      // HTT1:
+    uint16_t    timeout;            // TIM: (s)
+    uint8_t     fan1;               // DF1: (%)
+    uint8_t     reserved;
+} StatusRecord;
+
+static_assert(sizeof(StatusRecord) == 22, "StatusRecord layout is documented in wi-control.md");
+
+class SmuffStatus {
+
+private:
+    static bool isOn(const char* val, size_t len) {
+        return len == 2 && val[0] == 'o' && val[1] == 'n';
+    }
+
+    static int toInt(const char* val, size_t len) {
+        char tmp[12];
+        if(len >= sizeof(tmp))
+            len = sizeof(tmp)-1;
+        memcpy(tmp, val, len);
+        tmp[len] = 0;
+        return atoi(tmp);
+    }
+
+    // copies text which ends up in JSON, hence quotes and control chars get replaced
+    static void copyText(char* dest, const char* src, size_t len) {
+        while(len > 0 && (src[len-1] == '\n' || src[len-1] == '\r' || src[len-1] == ' '))
+            len--;
+        if(len >= STATUS_TEXT_LEN)
+            len = STATUS_TEXT_LEN-1;
+        for(size_t n = 0; n < len; n++)
+            dest[n] = src[n] == '"' || src[n] == '\\' || src[n] < ' ' ? ' ' : src[n];
+        dest[len] = 0;
+    }
+
+    // like strstr(), but stays within len; frames handed out by LineFramer aren't terminated
+    static const char* find(const char* line, size_t len, const char* what) {
+        size_t wlen = strlen(what);
+        for(size_t pos = 0; pos + wlen <= len; pos++) {
+            if(memcmp(line+pos, what, wlen) == 0)
+                return line+pos;
+        }
+        return nullptr;
+    }
+
+    void setFlag(uint16_t flag, bool state) {
+        if(state)
+            record.flags |= flag;
+        else
+            record.flags &= ~flag;
+    }
+
+    bool setField(const char* key, size_t klen, const char* val, size_t vlen) {
+        #define isKey(k) (klen == sizeof(k)-1 && strncmp(key, k, klen) == 0)
+        if(isKey("T:"))         record.tool = (int8_t)toInt(val, vlen);
+        else if(isKey("S:"))    setFlag(ST_SELECTOR, isOn(val, vlen));
+        else if(isKey("R:"))    setFlag(ST_REVOLVER, isOn(val, vlen));
+        else if(isKey("F:"))    setFlag(ST_FEEDER, isOn(val, vlen));
+        else if(isKey("F2:"))   setFlag(ST_FEEDER2, isOn(val, vlen));
+        else if(isKey("SD:"))   setFlag(ST_SDCARD, isOn(val, vlen));
+        else if(isKey("SC:"))   setFlag(ST_SETTINGS, isOn(val, vlen));
+        else if(isKey("LID:"))  setFlag(ST_LID, isOn(val, vlen));
+        else if(isKey("I:"))    setFlag(ST_IDLE, isOn(val, vlen));
+        else if(isKey("HON:"))  setFlag(ST_HEATER_ON, isOn(val, vlen));
+        else if(isKey("RLY:"))  setFlag(ST_RELAY_EXT, vlen == 3 && strncmp(val, "EXT", 3) == 0);
+        else if(isKey("SPL:"))  record.spool = (int8_t)toInt(val, vlen);
+        else if(isKey("TMP1:")) record.temp1 = toInt(val, vlen);
+        else if(isKey("TMP2:")) record.temp2 = toInt(val, vlen);
+        else if(isKey("HUM1:")) record.hum1 = toInt(val, vlen);
+        else if(isKey("HUM2:")) record.hum2 = toInt(val, vlen);
+        else if(isKey("HT1:"))  record.heater1 = toInt(val, vlen);
+        else if(isKey("HTT1:")) record.heater1Target = toInt(val, vlen);
+        else if(isKey("TIM:"))  record.timeout = toInt(val, vlen);
+        else if(isKey("DF1:"))  record.fan1 = toInt(val, vlen);
+        else return false;
+        return true;
+        #undef isKey
+    }
+
+public:
+    StatusRecord    record;
+    char            firmware[STATUS_TEXT_LEN] = { 0 };      // FIRMWARE_VERSION of M115
+    char            lastError[STATUS_TEXT_LEN] = { 0 };
+    uint32_t        lastReport = 0;         // millis() of the last status line
+    uint32_t        lastErrorTime = 0;
+    uint32_t        lastStart = 0;
+    unsigned long   reports = 0;            // status lines parsed
+    unsigned long   unknownFields = 0;      // fields the record has no slot for
+    unsigned long   errors = 0;
+    unsigned long   resets = 0;             // "start" lines seen
+
+    SmuffStatus() {
+        reset();
+    }
+
+    void reset() {
+        memset(&record, 0, sizeof(record));
+        record.magic = STATUS_MAGIC;
+        record.version = STATUS_VERSION;
+        record.tool = -1;
+        record.spool = -1;
+        record.temp1 = record.temp2 = STATUS_NO_VALUE;
+        record.hum1 = record.hum2 = STATUS_NO_VALUE;
+        record.heater1 = record.heater1Target = STATUS_NO_VALUE;
+    }
+
+    static bool isStatusLine(const char* line, size_t len) {
+        return len > 14 && strncmp(line, "echo: states: ", 14) == 0;
+    }
+
+    /*
+     * Updates the record from a status line (as checked by isStatusLine()).
+     * Fields not contained in the line keep their previous value.
+     */
+    bool parse(const char* line, size_t len) {
+        if(!isStatusLine(line, len))
+            return false;
+        const char* key = nullptr;
+        size_t klen = 0;
+        size_t pos = 14;
+        while(pos < len) {
+            while(pos < len && (line[pos] == ' ' || line[pos] == '\r' || line[pos] == '\n'))
+                pos++;
+            size_t start = pos;
+            while(pos < len && line[pos] != ' ' && line[pos] != '\r' && line[pos] != '\n')
+                pos++;
+            if(pos == start)
+                break;
+            if(line[pos-1] == ':') {
+                key = &line[start];
+                klen = pos - start;
+            }
+            else if(key != nullptr) {
+                if(!setField(key, klen, &line[start], pos - start))
+                    unknownFields++;
+                key = nullptr;
+            }
+        }
+        reports++;
+        lastReport = millis();
+        return true;
+    }
+
+    /*
+     * Feeds a complete line received from the SMuFF into the model.
+     * Returns true if it was a status report.
+     */
+    bool update(const char* line, size_t len) {
+        if(parse(line, len))
+            return true;
+        if(len >= 6 && strncmp(line, "error:", 6) == 0) {
+            copyText(lastError, line+6, len-6);
+            lastErrorTime = millis();
+            errors++;
+        }
+        else if(len >= 13 && strncmp(line, "FIRMWARE_NAME", 13) == 0) {
+            const char* end = line+len;
+            const char* ver = find(line, len, "FIRMWARE_VERSION:");
+            if(ver != nullptr) {
+                ver += 17;
+                while(ver < end && *ver == ' ')
+                    ver++;
+                size_t vlen = 0;
+                while(ver+vlen < end && ver[vlen] != ' ')
+                    vlen++;
+                copyText(firmware, ver, vlen);
+            }
+        }
+        else if(len >= 5 && strncmp(line, "start", 5) == 0) {
+            lastStart = millis();
+            resets++;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+/*
+ * Lock-free ring buffer for exactly one producer and one consumer, which
+ * may run in different tasks/cores or in an ISR. Neither side ever blocks
+ * or disables interrupts; data is moved in bulk.
+ *
+ * Capacity must be a power of two. head and tail are free running and
+ * only wrap at 2^32, hence size() is always head - tail.
+ */
+template<typename T, size_t Capacity>
+class SpscRing {
+
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    typedef struct {
+        T*      data;
+        size_t  len;
+    } Span;
+
+private:
+    T                       buffer[Capacity];
+    std::atomic<uint32_t>   head { 0 };         // written by the producer only
+    std::atomic<uint32_t>   tail { 0 };         // written by the consumer only
+    uint32_t                highWater = 0;
+
+    static constexpr uint32_t mask = Capacity - 1;
+
+    void updateHighWater(uint32_t used) {
+        if(used > highWater)
+            highWater = used;
+    }
+
+public:
+    size_t capacity() const {
+        return Capacity;
+    }
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    size_t free() const {
+        return Capacity - size();
+    }
+    bool isEmpty() const {
+        return size() == 0;
+    }
+    bool isFull() const {
+        return size() == Capacity;
+    }
+    size_t getHighWater() const {
+        return highWater;
+    }
+    void resetHighWater() {
+        highWater = size();
+    }
+
+    /*
+     * Producer side
+     */
+    size_t push(const T* data, size_t len) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t used = h - tail.load(std::memory_order_acquire);
+        if(len > Capacity - used)
+            len = Capacity - used;
+        size_t ofs = h & mask;
+        size_t first = min(len, Capacity - ofs);
+        memcpy(&buffer[ofs], data, first * sizeof(T));
+        memcpy(&buffer[0], data + first, (len - first) * sizeof(T));
+        head.store(h + len, std::memory_order_release);
+        updateHighWater(used + len);
+        return len;
+    }
+    bool push(const T item) {
+        return push(&item, 1) == 1;
+    }
+    // contiguous free space to write into directly; finish with produce()
+    Span writable() {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t used = h - tail.load(std::memory_order_acquire);
+        size_t ofs = h & mask;
+        return Span { &buffer[ofs], min((size_t)(Capacity - used), Capacity - ofs) };
+    }
+    void produce(size_t len) {
+        uint32_t h = head.load(std::memory_order_relaxed) + len;
+        head.store(h, std::memory_order_release);
+        updateHighWater(h - tail.load(std::memory_order_acquire));
+    }
+
+    /*
+     * Consumer side
+     */
+    // contiguous data available for reading; finish with commit()
+    Span peek() const {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        size_t ofs = t & mask;
+        return Span { (T*)&buffer[ofs], min(avail, Capacity - ofs) };
+    }
+    void commit(size_t len) {
+        tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+    size_t pop(T* data, size_t len) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        if(len > avail)
+            len = avail;
+        size_t ofs = t & mask;
+        size_t first = min(len, Capacity - ofs);
+        memcpy(data, &buffer[ofs], first * sizeof(T));
+        memcpy(data + first, &buffer[0], (len - first) * sizeof(T));
+        tail.store(t + len, std::memory_order_release);
+        return len;
+    }
+    bool pop(T& item) {
+        return pop(&item, 1) == 1;
+    }
+    // element at index (relative to the oldest one), no bounds check
+    const T& operator[](size_t index) const {
+        return buffer[(tail.load(std::memory_order_relaxed) + index) & mask];
+    }
+    void clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+};
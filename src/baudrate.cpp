@@ -0,0 +1,233 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Negotiates a higher baudrate with the SMuFF:
+ *  1. hold the command queue and wait until the commands in flight are done
+ *  2. tell the SMuFF the new rate (BAUD_CMD) at the current rate and wait for its "ok"
+ *  3. switch the local UART and send a probe (M115)
+ *  4. if the FIRMWARE_ line comes back clean, keep and store the new rate,
+ *     otherwise tell the SMuFF to go back (at the new rate) and verify the old one
+ * The replies to BAUD_CMD and the probes are consumed here (see baudrateLine()),
+ * so they neither retire queued commands nor reach the WebSocket clients.
+ */
+
+#define BAUD_CFG_FILE       "/baudrate.txt"
+#define BAUD_CMD            "M575 P%d B%lu\n"
+#define BAUD_PROBE_CMD      "M115\n"
+#define BAUD_ACK_TIMEOUT    250     // ms
+#define BAUD_PROBE_TIMEOUT  1000    // ms
+#define BAUD_ERR_LIMIT      10      // RX errors per second which trigger a fallback
+
+typedef enum {
+    BAUD_IDLE = 0,
+    BAUD_DRAIN,
+    BAUD_SWITCH,
+    BAUD_PROBE,
+    BAUD_VERIFY
+} BaudState;
+
+const unsigned long baudRates[] = { 115200, 230400, 460800, 921600 };
+
+unsigned long       baudRate = BAUDRATE;
+unsigned long       rxRate = 0, rxRatePeak = 0;         // B/s
+static BaudState    baudState = BAUD_IDLE;
+static unsigned long baudTarget, baudPrev;
+static int          baudPort = SMUFF_PORT;
+static bool         baudGotOk, baudGotProbe, baudSendRevert;
+static uint8_t      baudOks = 0;                        // "ok"s still expected for BAUD_CMD or a probe
+static uint32_t     baudMillis, baudProbeMillis, rateMillis;
+static unsigned long baudErrors, rateBytes, rateErrors;
+
+bool isValidBaudrate(unsigned long rate) {
+    for(uint8_t i=0; i < ArraySize(baudRates); i++) {
+        if(baudRates[i] == rate)
+            return true;
+    }
+    return false;
+}
+
+void saveBaudrate() {
+    File cfg = LittleFS.open(BAUD_CFG_FILE, "w");
+    if(cfg) {
+        cfg.print(baudRate);
+        cfg.close();
+    }
+}
+
+void switchLocalBaudrate(unsigned long rate) {
+    SerialSmuff.flush();
+    SerialSmuff.updateBaudRate(rate);
+    baudRate = rate;
+}
+
+void sendProbe(BaudState next) {
+    baudGotProbe = false;
+    baudErrors = rxErrors;
+    baudOks = 1;                    // replies to earlier commands at the wrong rate are lost anyway
+    writeToSmuff(BAUD_PROBE_CMD);
+    baudProbeMillis = millis();
+    baudState = next;
+}
+
+void fallbackBaudrate() {
+    __debugS(PSTR("Link at %lu Baud failed, falling back to %lu Baud"), baudRate, baudPrev);
+    if(baudSendRevert) {
+        char cmd[40];
+        snprintf_P(cmd, ArraySize(cmd), PSTR(BAUD_CMD), baudPort, baudPrev);
+        writeToSmuff(cmd);
+    }
+    switchLocalBaudrate(baudPrev);
+    sendProbe(BAUD_VERIFY);
+}
+
+/*
+ * Reads the rate negotiated last time and verifies the SMuFF is still on it.
+ */
+void initBaudrate() {
+    File cfg = LittleFS.open(BAUD_CFG_FILE, "r");
+    if(!cfg)
+        return;
+    unsigned long rate = cfg.readStringUntil('\n').toInt();
+    cfg.close();
+    if(rate == baudRate || !isValidBaudrate(rate))
+        return;
+    __debugS(PSTR("Trying stored baudrate %lu"), rate);
+    baudPrev = baudRate;
+    baudSendRevert = false;
+    switchLocalBaudrate(rate);
+    sendProbe(BAUD_PROBE);
+}
+
+bool startBaudSwitch(unsigned long rate, int port) {
+    if(isBaudSwitching() || !isValidBaudrate(rate))
+        return false;
+    baudTarget = rate;
+    baudPrev = baudRate;
+    baudPort = port;
+    baudSendRevert = true;
+    baudState = BAUD_DRAIN;         // the command queue is on hold from now on
+    return true;
+}
+
+void sendBaudCommand() {
+    char cmd[40];
+    baudGotOk = false;
+    baudOks = 1;
+    snprintf_P(cmd, ArraySize(cmd), PSTR(BAUD_CMD), baudPort, baudTarget);
+    writeToSmuff(cmd);
+    baudMillis = millis();
+    baudState = BAUD_SWITCH;
+}
+
+/*
+ * Returns true while the command queue has to be held.
+ */
+bool isBaudSwitching() {
+    return baudState != BAUD_IDLE || baudOks > 0;
+}
+
+/*
+ * Gets called for each complete line received from the SMuFF.
+ * Returns true if the line was a reply to BAUD_CMD or a probe.
+ */
+bool baudrateLine(const char* line, size_t len) {
+    if(!isBaudSwitching())
+        return false;
+    if(len >= 2 && strncmp_P(line, PSTR("ok"), 2) == 0) {
+        if(baudOks == 0)
+            return false;           // belongs to a command sent before the switch
+        baudOks--;
+        if(baudState == BAUD_SWITCH)
+            baudGotOk = true;
+        return true;
+    }
+    if((baudState == BAUD_PROBE || baudState == BAUD_VERIFY) && len >= 14 && strncmp_P(line, PSTR("FIRMWARE_"), 9) == 0) {
+        baudGotProbe = true;
+        return true;
+    }
+    return false;
+}
+
+void loopBaudrate() {
+    uint32_t now = millis();
+
+    if(now - rateMillis >= 1000) {
+        rxRate = (rxBytes - rateBytes) * 1000 / (now - rateMillis);
+        if(rxRate > rxRatePeak)
+            rxRatePeak = rxRate;
+        // a SMuFF which got reset runs on its default rate again
+        if(baudState == BAUD_IDLE && baudRate != BAUDRATE && rxErrors - rateErrors > BAUD_ERR_LIMIT) {
+            baudPrev = BAUDRATE;
+            baudSendRevert = true;
+            fallbackBaudrate();
+        }
+        rateBytes = rxBytes;
+        rateErrors = rxErrors;
+        rateMillis = now;
+    }
+
+    switch(baudState) {
+        case BAUD_IDLE:
+            // the probe's "ok" hasn't come back
+            if(baudOks > 0 && now - baudProbeMillis > BAUD_PROBE_TIMEOUT)
+                baudOks = 0;
+            break;
+
+        case BAUD_DRAIN:
+            if(cmdInFlight == 0 && !isInfoProbing())
+                sendBaudCommand();
+            break;
+
+        case BAUD_SWITCH:
+            if(baudGotOk || now - baudMillis > BAUD_ACK_TIMEOUT) {
+                switchLocalBaudrate(baudTarget);
+                sendProbe(BAUD_PROBE);
+            }
+            break;
+
+        case BAUD_PROBE:
+            if(rxErrors != baudErrors || now - baudProbeMillis > BAUD_PROBE_TIMEOUT) {
+                fallbackBaudrate();
+            }
+            else if(baudGotProbe) {
+                uint32_t rtt = now - baudProbeMillis;
+                saveBaudrate();
+                rxRatePeak = 0;
+                __debugS(PSTR("Link switched to %lu Baud"), baudRate);
+                sendResponse(PSTR("SMuFF link running at %lu Baud (%lu B/s theoretical), probe answered in %u ms.\nSee SYS:STATS for the throughput achieved."), baudRate, baudRate / 10, rtt);
+                baudState = BAUD_IDLE;
+            }
+            break;
+
+        case BAUD_VERIFY:
+            if(baudGotProbe) {
+                saveBaudrate();
+                sendResponse(PSTR("SMuFF link fell back to %lu Baud."), baudRate);
+                baudState = BAUD_IDLE;
+            }
+            else if(now - baudProbeMillis > BAUD_PROBE_TIMEOUT) {
+                saveBaudrate();
+                sendResponse(PSTR("SMuFF doesn't respond at %lu Baud either!"), baudRate);
+                baudState = BAUD_IDLE;
+            }
+            break;
+    }
+}
@@ -0,0 +1,143 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+#if defined(ESP32) && !defined(NOBT)
+
+/*
+ * Bridges the SMuFF to a Bluetooth serial (SPP) client in blocks, through
+ * a ring buffer for each direction:
+ *
+ *   SMuFF -> BT:   the bridge task puts what it reads from the UART into btTxRing,
+ *                  the BT task writes it to SerialBT up to BT_CHUNK_SIZE bytes at a time
+ *   BT -> SMuFF:   the BT task reads from SerialBT into btRxRing, loop() splits
+ *                  it into lines and queues them as commands (BT_ISSUER)
+ *
+ * SerialBT.write() blocks while the SPP stack is congested, which now only
+ * holds up the BT task, not the UART. Data for a client which can't keep up
+ * gets dropped (and counted) when btTxRing is full.
+ * The commands go through the command queue like the ones from the WebSocket
+ * and TCP clients, hence the SMuFF's "ok"s retire the right ones.
+ */
+
+#define BT_BUFSIZE          2048    // per direction, must be a power of two
+#define BT_CHUNK_SIZE       512     // max. bytes per SerialBT.write()
+#define BT_TASK_PRIO        2       // below the bridge task
+#define BT_TASK_STACK       3072
+#define BT_TASK_POLL        10      // ms
+
+typedef SpscRing<uint8_t, BT_BUFSIZE> BtRing;
+
+static BtRing       btTxRing, btRxRing;
+static LineFramer<BtRing, CHUNK_SIZE> btFramer;
+static TaskHandle_t btTask = nullptr;
+unsigned long       btTxBytes = 0, btRxBytes = 0, btRxLines = 0, btTxDropped = 0, btTxWrites = 0;
+
+static unsigned long countLines(const uint8_t* data, size_t len) {
+    unsigned long lines = 0;
+    const uint8_t* end = data + len;
+    while((data = (const uint8_t*)memchr(data, '\n', end - data)) != nullptr) {
+        lines++;
+        data++;
+    }
+    return lines;
+}
+
+/*
+ * Gets called by the bridge task for the data read from the SMuFF.
+ */
+void btBridgeData(const uint8_t* data, size_t len) {
+    if(btConnections <= 0 || btTask == nullptr)
+        return;
+    size_t queued = btTxRing.push(data, len);
+    if(queued < len)
+        btTxDropped += len - queued;
+    btSent += countLines(data, queued);
+    xTaskNotifyGive(btTask);
+}
+
+/*
+ * Gets called from loop(); queues the lines received from the BT client.
+ */
+void loopBtCommands() {
+    size_t len;
+    while((len = btFramer.scan(btRxRing)) > 0) {
+        queueCommands(btFramer.next(btRxRing, len), len, BT_ISSUER);
+        btFramer.release(btRxRing);
+        btRxLines++;
+    }
+}
+
+void btLoop(void* param) {
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BT_TASK_POLL));
+        if(btConnections <= 0) {
+            btTxRing.clear();
+            continue;
+        }
+        BtRing::Span span;
+        while((span = btTxRing.peek()).len > 0) {
+            size_t len = SerialBT.write(span.data, min(span.len, (size_t)BT_CHUNK_SIZE));
+            if(len == 0)
+                break;
+            btTxRing.commit(len);
+            btTxBytes += len;
+            btTxWrites++;
+        }
+        int avail;
+        while((avail = SerialBT.available()) > 0) {
+            span = btRxRing.writable();
+            if(span.len == 0)
+                break;                      // stays in the SPP buffer until loop() has caught up
+            size_t len = SerialBT.readBytes(span.data, min((size_t)avail, span.len));
+            if(len == 0)
+                break;
+            btRxRing.produce(len);
+            btRxBytes += len;
+        }
+    }
+}
+
+void startBtBridge() {
+    if(xTaskCreatePinnedToCore(btLoop, "bt", BT_TASK_STACK, nullptr, BT_TASK_PRIO, &btTask, BRIDGE_TASK_CORE) != pdPASS) {
+        __debugS(PSTR("Bluetooth task failed to start!"));
+        btTask = nullptr;
+    }
+}
+
+int getBtStats(char* buf, size_t len) {
+    return snprintf_P(buf, len, PSTR("BT to client:\t%lu B, %lu lines, %lu writes (avg. %lu B), %lu B dropped, queue %u/%u B (max. %u)\nBT from client:\t%lu B, %lu lines, queue %u B\n"),
+        btTxBytes,
+        btSent,
+        btTxWrites,
+        btTxWrites > 0 ? btTxBytes / btTxWrites : 0,
+        btTxDropped,
+        btTxRing.size(),
+        btTxRing.capacity(),
+        btTxRing.getHighWater(),
+        btRxBytes,
+        btRxLines,
+        btRxRing.size());
+}
+
+unsigned int getBtQueueDepth() {
+    return btTxRing.size();
+}
+
+#endif
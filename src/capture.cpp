@@ -0,0 +1,245 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Records the data exchanged with the SMuFF, in both directions, with
+ * timestamps (in µs). The records are kept in a ring buffer in RAM (PSRAM
+ * if available), where the oldest ones get overwritten, or are spilled
+ * into CAPTURE_FILE by loopCapture(). See "Capture format" in wi-control.md.
+ *
+ * On ESP32 the receiving side runs in the bridge task, hence the ring
+ * is guarded by a spinlock; captureOn is checked again while holding it,
+ * so once it's off (and the lock released), nothing writes into the ring.
+ */
+
+#if defined(ESP32)
+#define CAPTURE_PSRAM_SIZE  (512*1024)
+#define CAPTURE_RAM_SIZE    (32*1024)
+#else
+#define CAPTURE_RAM_SIZE    (8*1024)
+#endif
+#define CAPTURE_FILE_MAX    (512*1024)
+#define CAPTURE_SPILL_CHUNK 512
+
+#if defined(ESP32)
+static portMUX_TYPE     capMux = portMUX_INITIALIZER_UNLOCKED;
+#define CAP_LOCK()      portENTER_CRITICAL(&capMux)
+#define CAP_UNLOCK()    portEXIT_CRITICAL(&capMux)
+#else
+#define CAP_LOCK()
+#define CAP_UNLOCK()
+#endif
+
+static uint8_t*     capBuf = nullptr;
+static size_t       capSize = 0, capHead = 0, capTail = 0, capUsed = 0;
+static size_t       capSnapTail = 0, capSnapUsed = 0;      // what's being downloaded
+static File         capFile;
+static size_t       capFileSize = 0;
+volatile bool       captureOn = false;
+bool                captureToFile = false;
+unsigned long       capRecords = 0, capBytes = 0, capLost = 0, capOverwritten = 0;
+
+void capPut(const void* data, size_t len) {
+    const uint8_t* src = (const uint8_t*)data;
+    size_t first = min(len, capSize - capHead);
+    memcpy(&capBuf[capHead], src, first);
+    memcpy(&capBuf[0], src + first, len - first);
+    capHead = (capHead + len) % capSize;
+    capUsed += len;
+}
+
+void capGet(size_t pos, void* data, size_t len) {
+    uint8_t* dst = (uint8_t*)data;
+    pos %= capSize;
+    size_t first = min(len, capSize - pos);
+    memcpy(dst, &capBuf[pos], first);
+    memcpy(dst + first, &capBuf[0], len - first);
+}
+
+void capDropOldest() {
+    CaptureRecord rec;
+    capGet(capTail, &rec, sizeof(rec));
+    size_t len = sizeof(rec) + rec.len;
+    capTail = (capTail + len) % capSize;
+    capUsed -= len;
+    capOverwritten++;
+}
+
+/*
+ * Gets called for the data received from (CAP_RX) or sent to (CAP_TX) the SMuFF.
+ */
+void captureData(uint8_t dir, const uint8_t* data, size_t len) {
+    if(!captureOn || len == 0)
+        return;
+    if(len > 0xFFFF)
+        len = 0xFFFF;
+    size_t need = sizeof(CaptureRecord) + len;
+    CaptureRecord rec = { (uint32_t)micros(), dir, 0, (uint16_t)len };
+    CAP_LOCK();
+    if(!captureOn) {
+        // stopped meanwhile, capBuf may be gone
+        CAP_UNLOCK();
+        return;
+    }
+    if(need > capSize || (captureToFile && capSize - capUsed < need)) {
+        // the file can't keep up (or the record is too big): lose the newest data
+        capLost++;
+        CAP_UNLOCK();
+        return;
+    }
+    while(capSize - capUsed < need)
+        capDropOldest();
+    capPut(&rec, sizeof(rec));
+    capPut(data, len);
+    capRecords++;
+    capBytes += len;
+    CAP_UNLOCK();
+}
+
+void writeCaptureHeader(File& file) {
+    CaptureHeader hdr = { { 'S', 'M', 'C', 'P' }, CAPTURE_VERSION, 0 };
+    file.write((const uint8_t*)&hdr, sizeof(hdr));
+}
+
+bool startCapture(bool toFile) {
+    if(captureOn)
+        return false;
+    if(capBuf == nullptr) {
+        #if defined(ESP32)
+        if(psramFound()) {
+            capBuf = (uint8_t*)ps_malloc(CAPTURE_PSRAM_SIZE);
+            capSize = CAPTURE_PSRAM_SIZE;
+        }
+        #endif
+        if(capBuf == nullptr) {
+            capBuf = (uint8_t*)malloc(CAPTURE_RAM_SIZE);
+            capSize = CAPTURE_RAM_SIZE;
+        }
+        if(capBuf == nullptr) {
+            capSize = 0;
+            return false;
+        }
+    }
+    capHead = capTail = capUsed = 0;
+    capRecords = capBytes = capLost = capOverwritten = 0;
+    captureToFile = toFile;
+    if(toFile) {
+        capFile = LittleFS.open(CAPTURE_FILE, "w");
+        if(!capFile)
+            return false;
+        writeCaptureHeader(capFile);
+        capFileSize = sizeof(CaptureHeader);
+    }
+    CAP_LOCK();
+    captureOn = true;
+    CAP_UNLOCK();
+    __debugS(PSTR("Capture started (%u B buffer%s)"), capSize, toFile ? ", spilling to " CAPTURE_FILE : "");
+    return true;
+}
+
+/*
+ * Writes the records buffered to the capture file, a chunk at a time.
+ */
+bool spillCapture() {
+    uint8_t chunk[CAPTURE_SPILL_CHUNK];
+    CAP_LOCK();
+    size_t len = min(capUsed, sizeof(chunk));
+    capGet(capTail, chunk, len);
+    CAP_UNLOCK();
+    if(len == 0)
+        return false;
+    capFile.write(chunk, len);
+    capFileSize += len;
+    CAP_LOCK();
+    capTail = (capTail + len) % capSize;
+    capUsed -= len;
+    CAP_UNLOCK();
+    return true;
+}
+
+void stopCapture() {
+    if(!captureOn)
+        return;
+    CAP_LOCK();
+    captureOn = false;
+    CAP_UNLOCK();
+    if(captureToFile && capFile) {
+        while(spillCapture())
+            ;
+        capFile.close();
+    }
+    __debugS(PSTR("Capture stopped: %lu records, %lu B"), capRecords, capBytes);
+}
+
+void clearCapture() {
+    stopCapture();
+    CAP_LOCK();
+    uint8_t* buf = capBuf;
+    capBuf = nullptr;
+    capSize = capHead = capTail = capUsed = 0;
+    capSnapTail = capSnapUsed = 0;
+    CAP_UNLOCK();
+    if(buf != nullptr)
+        free(buf);
+    captureToFile = false;
+    LittleFS.remove(CAPTURE_FILE);
+}
+
+/*
+ * For streaming the RAM capture: pauses capturing, so the records can't
+ * get overwritten, and returns the number of bytes buffered, which then
+ * can be read with readCapture(). resumeCapture() continues capturing.
+ */
+size_t pauseCapture(bool& wasOn) {
+    CAP_LOCK();
+    wasOn = captureOn;
+    captureOn = false;
+    capSnapTail = capTail;
+    capSnapUsed = captureToFile ? 0 : capUsed;
+    CAP_UNLOCK();
+    return capSnapUsed;
+}
+
+void resumeCapture(bool wasOn) {
+    CAP_LOCK();
+    captureOn = wasOn && capBuf != nullptr;
+    CAP_UNLOCK();
+}
+
+size_t readCapture(size_t offset, uint8_t* data, size_t len) {
+    if(offset >= capSnapUsed)
+        return 0;
+    len = min(len, capSnapUsed - offset);
+    CAP_LOCK();
+    capGet(capSnapTail + offset, data, len);
+    CAP_UNLOCK();
+    return len;
+}
+
+void loopCapture() {
+    if(!captureOn || !captureToFile)
+        return;
+    if(capFileSize >= CAPTURE_FILE_MAX) {
+        __debugS(PSTR("Capture file is full"));
+        stopCapture();
+        return;
+    }
+    spillCapture();
+}
@@ -0,0 +1,308 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Queues the commands received from the WebSocket client and sends them
+ * to the SMuFF in a sliding window: up to cmdWindow commands may be
+ * unacknowledged at a time, each "ok" coming back opens the window
+ * for the next one (like Marlin's ADVANCED_OK does on the host side).
+ * Commands are stored newline terminated in the ring buffer, each one
+ * preceded by the WebSocket client which has sent it, and get written to
+ * the UART from there, without being copied again. The senders of the
+ * commands in flight are kept in order, so the SMuFF's replies can be
+ * routed back to them (see commandIssuer()).
+ * Since every "ok" retires the oldest command in flight, all commands for
+ * the SMuFF have to come through here, each sender with an issuer of its
+ * own: the WebSocket client number, TCP_ISSUER or BT_ISSUER. Only the
+ * WI-ESP's own probes, which consume their replies, bypass the queue.
+ * queueCommands() must be called from loop() only.
+ *
+ * With checksums turned on, each command is sent as "N<line> <cmd>*<checksum>"
+ * (checksum = XOR of all bytes before the '*') and kept in a small history,
+ * from which it gets sent again if the SMuFF asks for it ("Resend: <line>").
+ */
+
+#define CMDQ_BUFSIZE    2048        // must be a power of two
+#define CMDQ_WINDOW     4           // default number of commands in flight
+#define CMDQ_TIMEOUT    30000       // ms without an "ok" until the window gets reopened
+#define CMDQ_HISTORY    CMDQ_MAX_WINDOW     // commands kept for resending, each one in flight may be requested
+#define CMDQ_LINE_LEN   128         // max. length of a framed command; longer ones are sent as they are
+
+typedef struct {
+    uint32_t    line;
+    uint8_t     len;
+    char        data[CMDQ_LINE_LEN];
+} SentLine;
+
+SpscRing<char, CMDQ_BUFSIZE> cmdQueue;
+uint8_t             cmdWindow = CMDQ_WINDOW;
+uint8_t             cmdInFlight = 0, cmdInFlightMax = 0;
+unsigned int        cmdPending = 0;
+unsigned long       cmdAcked = 0, cmdTimeouts = 0, cmdHeld = 0, cmdDropped = 0;     // cmdHeld = commands which had to wait
+bool                cmdChecksum = false;
+uint32_t            cmdLine = 0;
+unsigned long       cmdResent = 0, cmdResendFailed = 0;
+static SentLine     cmdHistory[CMDQ_HISTORY];
+static int8_t       cmdIssuers[CMDQ_MAX_WINDOW];    // senders of the commands in flight, oldest at cmdIssuerHead
+static uint8_t      cmdIssuerHead = 0;
+static uint8_t      cmdIgnoreOks = 0;
+static uint32_t     cmdResendFrom = UINT32_MAX;
+static bool         cmdLineReset = false;           // M110 has to go out ahead of the queue
+static uint32_t     cmdMillis;
+static unsigned long cmdResets = 0;
+
+/*
+ * Frames the command (without newline) and writes it to the UART.
+ * Returns false if it doesn't fit into the history.
+ */
+bool sendFramedCommand(const char* cmd, size_t len) {
+    // framed aside, so the history keeps the old line if it doesn't fit
+    char tmp[CMDQ_LINE_LEN];
+    int n = snprintf_P(tmp, CMDQ_LINE_LEN, PSTR("N%lu %.*s"), (unsigned long)cmdLine, (int)len, cmd);
+    if(n + 6 >= CMDQ_LINE_LEN)
+        return false;
+    uint8_t checksum = 0;
+    for(int i = 0; i < n; i++)
+        checksum ^= (uint8_t)tmp[i];
+    n += snprintf_P(tmp+n, CMDQ_LINE_LEN-n, PSTR("*%u\n"), checksum);
+    SentLine& sent = cmdHistory[cmdLine % CMDQ_HISTORY];
+    memcpy(sent.data, tmp, n);
+    sent.len = n;
+    sent.line = cmdLine++;
+    writeToSmuff((const uint8_t*)sent.data, sent.len);
+    return true;
+}
+
+void commandSent(int8_t issuer) {
+    if(cmdInFlight == 0)
+        cmdMillis = millis();
+    cmdIssuers[(cmdIssuerHead + cmdInFlight) % CMDQ_MAX_WINDOW] = issuer;
+    cmdInFlight++;
+    if(cmdInFlight > cmdInFlightMax)
+        cmdInFlightMax = cmdInFlight;
+}
+
+/*
+ * Restarts the line numbers with "N0 M110 N0", so the commands
+ * queued get numbered from 1 on.
+ */
+void sendLineReset() {
+    cmdLine = 0;
+    cmdLineReset = false;
+    sendFramedCommand("M110 N0", 7);
+    commandSent(WS_BROADCAST);
+}
+
+void sendQueuedCommand() {
+    char c;
+    cmdQueue.pop(c);
+    int8_t issuer = (int8_t)c;
+    size_t len = 0;
+    while(cmdQueue[len] != '\n')
+        len++;
+    len++;
+    char cmd[CMDQ_LINE_LEN];
+    if(cmdChecksum && len <= CMDQ_LINE_LEN) {
+        cmdQueue.pop(cmd, len);
+        if(!sendFramedCommand(cmd, len-1))
+            writeToSmuff((const uint8_t*)cmd, len);
+    }
+    else {
+        SpscRing<char, CMDQ_BUFSIZE>::Span span = cmdQueue.peek();
+        size_t first = min(len, span.len);
+        writeToSmuff((const uint8_t*)span.data, first);
+        cmdQueue.commit(first);
+        if(first < len) {
+            span = cmdQueue.peek();
+            writeToSmuff((const uint8_t*)span.data, len - first);
+            cmdQueue.commit(len - first);
+        }
+    }
+    cmdPending--;
+    wiSent++;
+    commandSent(issuer);
+}
+
+void pumpCommands() {
+    // held while the baudrate gets switched, its replies must not get mixed up with the ones to the queue
+    while(cmdInFlight < cmdWindow && !isBaudSwitching()) {
+        if(cmdLineReset)
+            sendLineReset();
+        else if(cmdPending > 0)
+            sendQueuedCommand();
+        else
+            break;
+    }
+}
+
+/*
+ * Splits the data received into single commands and queues them.
+ * With a window of 0, the data is passed through as it is.
+ */
+void queueCommands(const char* data, size_t len, int issuer) {
+    if(cmdWindow == 0) {
+        writeToSmuff((const uint8_t*)data, len);
+        wiSent++;
+        return;
+    }
+    while(len > 0) {
+        size_t cmdLen = 0;
+        while(cmdLen < len && data[cmdLen] != '\n')
+            cmdLen++;
+        size_t next = cmdLen < len ? cmdLen+1 : cmdLen;
+        while(cmdLen > 0 && data[cmdLen-1] == '\r')
+            cmdLen--;
+        if(cmdLen > 0) {
+            if(cmdQueue.free() < cmdLen+2) {
+                cmdDropped++;
+                __debugS(PSTR("Command queue full, command dropped!"));
+            }
+            else {
+                cmdQueue.push((char)issuer);
+                cmdQueue.push(data, cmdLen);
+                cmdQueue.push('\n');
+                cmdPending++;
+                if(cmdInFlight + cmdPending > cmdWindow)
+                    cmdHeld++;              // has to wait for an "ok"
+            }
+        }
+        data += next;
+        len -= next;
+    }
+    pumpCommands();
+}
+
+/*
+ * Sends the commands from line on again. The commands after the
+ * one which got corrupted were dropped by the SMuFF as well, each
+ * of them causing another request for the same line.
+ */
+void resendCommands(uint32_t line) {
+    // the "ok" following "Resend:" belongs to the rejected command
+    cmdIgnoreOks++;
+    if(line == cmdResendFrom)
+        return;
+    cmdResendFrom = line;
+    uint8_t resent = 0;
+    for(uint32_t l = line; l < cmdLine; l++) {
+        SentLine& sent = cmdHistory[l % CMDQ_HISTORY];
+        if(sent.line != l || cmdLine - l > CMDQ_HISTORY) {
+            __debugS(PSTR("Line %lu requested for resend is gone!"), (unsigned long)l);
+            cmdResendFailed++;
+            break;
+        }
+        writeToSmuff((const uint8_t*)sent.data, sent.len);
+        cmdResent++;
+        resent++;
+    }
+    // the senders of the commands resent stay in flight
+    if(resent < cmdInFlight)
+        cmdIssuerHead = (cmdIssuerHead + cmdInFlight - resent) % CMDQ_MAX_WINDOW;
+    cmdInFlight = resent;
+    cmdMillis = millis();
+}
+
+void ackCommand() {
+    if(cmdIgnoreOks > 0) {
+        cmdIgnoreOks--;
+        return;
+    }
+    cmdResendFrom = UINT32_MAX;
+    if(cmdInFlight == 0)
+        return;
+    cmdInFlight--;
+    cmdIssuerHead = (cmdIssuerHead + 1) % CMDQ_MAX_WINDOW;
+    cmdAcked++;
+    cmdMillis = millis();
+    pumpCommands();
+}
+
+/*
+ * Returns the WebSocket client the line received from the SMuFF belongs to.
+ * While commands are in flight, everything up to the next "ok" counts as
+ * a reply to the oldest one, except for what the SMuFF sends on its own:
+ * the "start" banner after a reset, "echo:" notifications and "error:"
+ * messages go to all clients (the issuer included).
+ */
+int commandIssuer(const char* line, size_t len) {
+    if(cmdInFlight == 0)
+        return WS_BROADCAST;
+    if((len >= 5 && strncmp_P(line, PSTR("start"), 5) == 0) ||
+       (len >= 5 && strncmp_P(line, PSTR("echo:"), 5) == 0) ||
+       (len >= 6 && strncmp_P(line, PSTR("error:"), 6) == 0))
+        return WS_BROADCAST;
+    return cmdIssuers[cmdIssuerHead];
+}
+
+/*
+ * Gets called for each complete line received from the SMuFF.
+ */
+void commandQueueLine(const char* line, size_t len) {
+    if(len >= 2 && line[0] == 'o' && line[1] == 'k')
+        ackCommand();
+    else if(cmdChecksum && len > 7 && strncmp_P(line, PSTR("Resend:"), 7) == 0)
+        resendCommands(strtoul(line+7, nullptr, 10));
+}
+
+void resetLineNumber() {
+    cmdLineReset = true;
+    pumpCommands();
+}
+
+bool setChecksum(bool on) {
+    if(on && cmdWindow == 0)
+        return false;
+    cmdChecksum = on;
+    if(on)
+        resetLineNumber();
+    return true;
+}
+
+void setCommandWindow(uint8_t window) {
+    cmdWindow = window;
+    if(window == 0) {
+        // flush what's left, the SMuFF will have to cope with it
+        while(cmdPending > 0)
+            sendQueuedCommand();
+        cmdInFlight = 0;
+        cmdChecksum = false;
+        cmdLineReset = false;
+    }
+    else
+        pumpCommands();
+}
+
+void loopCmdQueue() {
+    if(statusSMuFF.resets != cmdResets) {
+        // the commands in flight have gone with the reset
+        cmdResets = statusSMuFF.resets;
+        cmdInFlight = 0;
+        cmdIgnoreOks = 0;
+        cmdResendFrom = UINT32_MAX;
+        if(cmdChecksum)
+            resetLineNumber();
+    }
+    if(cmdInFlight > 0 && millis() - cmdMillis > CMDQ_TIMEOUT) {
+        __debugS(PSTR("No 'ok' for %u command(s), reopening window"), cmdInFlight);
+        cmdTimeouts++;
+        cmdInFlight = 0;
+    }
+    pumpCommands();
+}
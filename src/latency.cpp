@@ -0,0 +1,122 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Measures how long data from the SMuFF stays on the WI-ESP.
+ * Each chunk read from the UART gets an arrival mark (its end position in
+ * the byte stream and the time). When a line is framed, its arrival time
+ * is the one of the chunk which contained its last byte. From there
+ * two latencies are sampled:
+ *
+ *   latDispatch:   arrival -> line dispatched in loop() (buffering and, on ESP32, the bridge task)
+ *   latSend:       arrival -> frame handed to the WebSocket library (adds batching)
+ *
+ * Marks are pushed by the producer of bufFromSMuFF and taken by its consumer,
+ * hence they follow the same threading rules as the ring buffer itself.
+ */
+
+#define LAT_MARKS       64          // must be a power of two
+
+typedef struct {
+    uint32_t    end;                // stream position after the chunk
+    uint32_t    micros;
+} ArrivalMark;
+
+static SpscRing<ArrivalMark, LAT_MARKS> latMarks;
+static uint32_t     latProduced = 0, latConsumed = 0;
+LatencyHistogram    latDispatch, latSend;
+uint32_t            lineArrived = 0;
+bool                latStamps = false;
+unsigned long       latMarksLost = 0;
+
+/*
+ * Producer side: gets called for each chunk put into bufFromSMuFF.
+ */
+void markArrival(size_t len) {
+    latProduced += len;
+    if(!latMarks.push(ArrivalMark { latProduced, micros() | 1 }))
+        latMarksLost++;
+}
+
+/*
+ * Consumer side: gets called for each frame taken from bufFromSMuFF.
+ * Returns the arrival time of its last byte, 0 if unknown.
+ */
+uint32_t lineArrival(size_t len) {
+    ArrivalMark mark;
+    latConsumed += len;
+    while(!latMarks.isEmpty() && (int32_t)(latMarks[0].end - latConsumed) < 0)
+        latMarks.pop(mark);
+    return latMarks.isEmpty() ? 0 : latMarks[0].micros;
+}
+
+void addLatency(LatencyHistogram& hist, uint32_t arrived) {
+    if(arrived != 0)
+        hist.add(micros() - arrived);
+}
+
+void resetLatency() {
+    latDispatch.reset();
+    latSend.reset();
+}
+
+int printHistogram(char* buf, size_t len, const char* name, const LatencyHistogram& hist) {
+    return snprintf_P(buf, len, PSTR("%s\t%lu samples, avg. %lu us, p50 %lu us, p99 %lu us, max. %lu us\n"),
+        name,
+        (unsigned long)hist.count,
+        (unsigned long)hist.average(),
+        (unsigned long)hist.percentile(50),
+        (unsigned long)hist.percentile(99),
+        (unsigned long)hist.max);
+}
+
+int getLatencyStats(char* buf, size_t len) {
+    int n = printHistogram(buf, len, "Dispatch:", latDispatch);
+    if(n < (int)len)
+        n += printHistogram(buf+n, len-n, "WebSocket:", latSend);
+    return n;
+}
+
+/*
+ * Writes the histograms as JSON (for /latency), bucket limits in µs.
+ */
+int getLatencyJson(char* buf, size_t len) {
+    const LatencyHistogram* hists[] = { &latDispatch, &latSend };
+    const char* names[] = { "dispatch", "send" };
+    int n = snprintf_P(buf, len, PSTR("{\"bucketsUs\":["));
+    for(uint8_t b = 0; b < LAT_BUCKETS-1 && n < (int)len; b++)
+        n += snprintf_P(buf+n, len-n, PSTR("%s%lu"), b > 0 ? "," : "", (unsigned long)latDispatch.limit(b));
+    for(uint8_t h = 0; h < ArraySize(hists) && n < (int)len; h++) {
+        const LatencyHistogram& hist = *hists[h];
+        n += snprintf_P(buf+n, len-n, PSTR("]%s,\"%s\":{\"count\":%lu,\"avgUs\":%lu,\"p50Us\":%lu,\"p99Us\":%lu,\"maxUs\":%lu,\"buckets\":["),
+            h > 0 ? "}" : "",
+            names[h],
+            (unsigned long)hist.count,
+            (unsigned long)hist.average(),
+            (unsigned long)hist.percentile(50),
+            (unsigned long)hist.percentile(99),
+            (unsigned long)hist.max);
+        for(uint8_t b = 0; b < LAT_BUCKETS && n < (int)len; b++)
+            n += snprintf_P(buf+n, len-n, PSTR("%s%lu"), b > 0 ? "," : "", (unsigned long)hist.buckets[b]);
+    }
+    if(n < (int)len)
+        n += snprintf_P(buf+n, len-n, PSTR("]}}"));
+    return n;
+}
@@ -0,0 +1,157 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Debug and log messages are queued here and written to the UART by
+ * loopLog() in the background, instead of waiting for the (slow) UART in
+ * __debugS() / __logS(). If the UART can't keep up, the oldest messages
+ * get dropped to make room for the new ones.
+ *
+ * On ESP8266 the spare UART is bit-banged (SoftwareSerial), i.e. each byte
+ * keeps the CPU busy for ~0.5 ms at 19200 Baud, hence only LOG_SW_BUDGET
+ * bytes are written per run. With LOG_UART1 defined, the output goes to the
+ * hardware UART1 (TX only, GPIO2) instead, which only gets what fits into
+ * its FIFO. On ESP32 the spare UART has a TX buffer of its own.
+ * Messages may come from the bridge task as well, hence the spinlock.
+ */
+
+#define LOG_QUEUE_SIZE      2048
+#define LOG_SW_BUDGET       4       // bytes per run for SoftwareSerial (~2 ms)
+
+#if defined(LOG_UART1) && !defined(ESP32)
+#define LOG_PORT            Serial1
+#else
+#define LOG_PORT            SerialUART
+#endif
+
+#if defined(ESP32)
+static portMUX_TYPE     logMux = portMUX_INITIALIZER_UNLOCKED;
+#define LOG_LOCK()      portENTER_CRITICAL(&logMux)
+#define LOG_UNLOCK()    portEXIT_CRITICAL(&logMux)
+#else
+#define LOG_LOCK()
+#define LOG_UNLOCK()
+#endif
+
+static char         logBuf[LOG_QUEUE_SIZE];
+static size_t       logHead = 0, logTail = 0, logUsed = 0;
+size_t              logPeak = 0;
+unsigned long       logQueued = 0, logDropped = 0, logDroppedBytes = 0, logWritten = 0;
+
+void initLog() {
+    #if defined(LOG_UART1) && !defined(ESP32)
+    Serial1.begin(LOG_BAUDRATE);
+    #endif
+}
+
+/*
+ * Removes the oldest message from the queue.
+ */
+void logDropOldest() {
+    size_t len = 0;
+    while(len < logUsed && logBuf[(logTail + len) % LOG_QUEUE_SIZE] != '\n')
+        len++;
+    if(len < logUsed)
+        len++;
+    logTail = (logTail + len) % LOG_QUEUE_SIZE;
+    logUsed -= len;
+    logDropped++;
+    logDroppedBytes += len;
+}
+
+void logPut(const char* data, size_t len) {
+    size_t first = min(len, LOG_QUEUE_SIZE - logHead);
+    memcpy(&logBuf[logHead], data, first);
+    memcpy(&logBuf[0], data + first, len - first);
+    logHead = (logHead + len) % LOG_QUEUE_SIZE;
+    logUsed += len;
+}
+
+/*
+ * Queues a message; a newline gets appended if requested.
+ */
+void logWrite(const char* msg, bool newline) {
+    size_t len = strlen(msg);
+    size_t need = len + (newline ? 2 : 0);
+    if(need > LOG_QUEUE_SIZE) {
+        len = LOG_QUEUE_SIZE - 2;
+        need = LOG_QUEUE_SIZE;
+    }
+    LOG_LOCK();
+    while(LOG_QUEUE_SIZE - logUsed < need)
+        logDropOldest();
+    logPut(msg, len);
+    if(newline)
+        logPut("\r\n", 2);
+    logQueued++;
+    if(logUsed > logPeak)
+        logPeak = logUsed;
+    LOG_UNLOCK();
+}
+
+/*
+ * Writes as much of the queue as the UART takes without waiting
+ * (or flushes all of it if wait is set, i.e. before a reboot).
+ */
+void drainLog(bool wait) {
+    char chunk[64];
+    for(;;) {
+        size_t room;
+        #if !defined(ESP32) && !defined(LOG_UART1)
+        room = wait ? sizeof(chunk) : LOG_SW_BUDGET;
+        #else
+        room = wait ? sizeof(chunk) : (size_t)LOG_PORT.availableForWrite();
+        #endif
+        LOG_LOCK();
+        size_t len = min(min(logUsed, room), sizeof(chunk));
+        size_t first = min(len, LOG_QUEUE_SIZE - logTail);
+        memcpy(chunk, &logBuf[logTail], first);
+        memcpy(chunk + first, &logBuf[0], len - first);
+        logTail = (logTail + len) % LOG_QUEUE_SIZE;
+        logUsed -= len;
+        LOG_UNLOCK();
+        if(len == 0)
+            return;
+        LOG_PORT.write((const uint8_t*)chunk, len);
+        logWritten += len;
+        if(!wait)
+            return;
+    }
+}
+
+void loopLog() {
+    drainLog(false);
+}
+
+void flushLog() {
+    drainLog(true);
+    LOG_PORT.flush();
+}
+
+int getLogStats(char* buf, size_t len) {
+    return snprintf_P(buf, len, PSTR("Debug queue:\t%u/%u B (max. %u), %lu messages, %lu B written, %lu dropped (%lu B)\n"),
+        logUsed,
+        LOG_QUEUE_SIZE,
+        logPeak,
+        logQueued,
+        logWritten,
+        logDropped,
+        logDroppedBytes);
+}
@@ -18,13 +18,10 @@
  */
 #include "Config.h"
 
-#define CHUNK_SIZE  250                           // max. number of bytes sent at one go over web-socket
-
 StringStream        debugOut;
 bool                debugToUART = true;
 bool                logToUART = false;
 bool                debugMemInfo = false;
-bool                isPinging = false;
 HardwareSerial      SerialSmuff(0);               // this one is mandatory!
 
 #if defined(ESP32)
@@ -45,16 +42,59 @@ EspSoftwareSerial::UART SerialUART;
 #endif
 
 
-String              fromSMuFF;
 unsigned long       smuffSent = 0, wiSent = 0, btSent = 0;
-RingBuf<byte, 2048> bufFromSMuFF;
-uint32_t            millisCurrent;
-uint32_t            millisLast;
-uint32_t            millisNpxRefresh;
+volatile unsigned long rxOverruns = 0, rxErrors = 0, rxDropped = 0, rxBytes = 0;
+volatile unsigned long txBytes = 0;
+unsigned long       loopIterations = 0, loopRate = 0;     // loop() calls, total and per second
+static unsigned long loopRateIterations = 0;
+#if defined(LOOP_PROFILER)
+LoopProfiler        loopProfiler;
+#endif
+static uint32_t     loopRateMillis = 0;
+FlowControl         flowControl = FLOW_OFF;
+bool                flowLossless = false;             // stop reading the UART while the ring buffer is full
+uint16_t            flowHighWater = FLOW_HIGH_WATER;
+uint16_t            flowLowWater = FLOW_LOW_WATER;
+bool                flowPaused = false;
+uint32_t            flowPausedSince;
+unsigned long       flowPauses = 0, flowPausedMs = 0, rxOverflows = 0;
+BridgeRing          bufFromSMuFF;
+LineFramer<BridgeRing, CHUNK_SIZE> framerSMuFF;
+SmuffStatus         statusSMuFF;
+Scheduler           scheduler;
 int                 btConnections = 0;
-uint16_t            chunkSize = CHUNK_SIZE;
+
+#if defined(ESP32)
+typedef struct {
+  uint16_t  len;
+  uint32_t  arrived;                // see lineArrival()
+  char      data[CHUNK_SIZE+1];
+} BridgeLine;
+
+TaskHandle_t        bridgeTask = nullptr;
+QueueHandle_t       bridgeQueue = nullptr;            // framed lines from the bridge task to loop()
+SemaphoreHandle_t   bridgeMutex = nullptr;
+unsigned long       bridgeQueueFull = 0;
+#endif
 
 #if defined (ESP32)
+void serialSmuffError(hardwareSerial_error_t err) {
+  // called from within the UART event task
+  switch(err) {
+    case UART_FIFO_OVF_ERROR:
+    case UART_BUFFER_FULL_ERROR:
+      rxOverruns++;
+      break;
+    case UART_FRAME_ERROR:
+    case UART_PARITY_ERROR:
+    case UART_BREAK_ERROR:
+      rxErrors++;
+      break;
+    default:
+      break;
+  }
+}
+
 void btStatus(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
   if (event == ESP_SPP_SRV_OPEN_EVT) {
     __debugS(PSTR("Bluetooth serial connected"));
@@ -81,6 +121,7 @@ void flashIntLED(int repeat, int _delay) {
 }
 
 void setup(){
+  initLog();
   #if defined(ESP32)
     esp_log_set_vprintf(__debugESP);
     initDisplay();
@@ -88,17 +129,21 @@ void setup(){
     drawScreen();
   #endif
 
-  fromSMuFF.reserve(1024);
   // initialize serial ports
   #if !defined(ESP32)
-    SerialUART.begin(BAUDRATE2, SWSERIAL_8N1, RXD2_PIN, TXD2_PIN, false);
+    SerialUART.begin(BAUDRATE2, SWSERIAL_8N1, RXD2_PIN, TXD2_PIN, false, UART_RX_BUFSIZE);
     __debugS(PSTR("Serial 2 (UART) initialized at %ld Baud"), BAUDRATE2);
+    SerialSmuff.setRxBufferSize(SMUFF_RX_BUFSIZE);  // filled by the UART ISR, independent of loop()
     SerialSmuff.begin(BAUDRATE);       // RXD0, TXD0
     __debugS(PSTR("Serial 1 initialized at %ld Baud"), BAUDRATE);
   #else
+    SerialUART.setRxBufferSize(UART_RX_BUFSIZE);
     SerialUART.begin(BAUDRATE2, SERIAL_8N1, RXD2_PIN, TXD2_PIN);
+    SerialUART.onReceiveError(serialUartError);
     __debugS(PSTR("Serial 2 (UART) initialized at %ld Baud"), BAUDRATE2);
+    SerialSmuff.setRxBufferSize(SMUFF_RX_BUFSIZE);  // filled by the UART driver ISR, independent of loop()
     SerialSmuff.begin (BAUDRATE, SERIAL_8N1, RXD0_PIN, TXD0_PIN);
+    SerialSmuff.onReceiveError(serialSmuffError);
     __debugS(PSTR("Serial 1 initialized at %ld Baud"), BAUDRATE);
     #if !defined(NOBT)
       // setup Bluetooth serial for SMuFF WebInterface connection (ESP32 only)
@@ -125,6 +170,7 @@ void setup(){
   __debugS(PSTR("Webserver init..."));
   initWebserver();
   initWebsockets();
+  initTcpBridge();
 
   #if defined(ESP32)
     #if defined(OLED_SSD1306) || defined(OLED_SH1106) || defined(OLED_SH1107)
@@ -134,150 +180,334 @@ void setup(){
     #endif
   #endif
 
-  millisLast = millis();
-  millisNpxRefresh = millisLast;
+  initScheduler();
+  flushLog();                     // messages from setup, the scheduler takes over from here
 
   flashIntLED(3);
   // NeoPixels by default set to 4 LEDs
   numLeds = DEFAULT_NUMLEDS;
   initNeoPixels();
+  #if defined(ESP32)
+    startBridgeTask();
+    #if !defined(NOBT)
+      startBtBridge();
+    #endif
+  #endif
+  #if defined(USE_FS)
+    initBaudrate();
+  #endif
+  initSmuffInfo();
   // __debugS(PSTR("Heap after setup: %zu B"), ESP.getFreeHeap());
 }
 
+void pauseSmuff(bool pause) {
+  switch(flowControl) {
+    case FLOW_XONXOFF:
+      SerialSmuff.write(pause ? XOFF : XON);
+      break;
+    case FLOW_RTS:
+      #if defined(RTS_PIN)
+        digitalWrite(RTS_PIN, pause ? HIGH : LOW);
+      #endif
+      break;
+    default:
+      break;
+  }
+  if(pause) {
+    flowPauses++;
+    flowPausedSince = millis();
+  }
+  else {
+    flowPausedMs += millis() - flowPausedSince;
+  }
+  flowPaused = pause;
+}
+
+bool setFlowControl(FlowControl mode) {
+  #if !defined(RTS_PIN)
+    if(mode == FLOW_RTS)
+      return false;
+  #endif
+  if(flowPaused)
+    pauseSmuff(false);
+  flowControl = mode;
+  #if defined(RTS_PIN)
+    if(mode == FLOW_RTS) {
+      pinMode(RTS_PIN, OUTPUT);
+      digitalWrite(RTS_PIN, LOW);
+    }
+  #endif
+  return true;
+}
+
+void checkFlowControl() {
+  if(flowControl == FLOW_OFF)
+    return;
+  size_t used = bufFromSMuFF.size();
+  if(!flowPaused && used >= flowHighWater)
+    pauseSmuff(true);
+  else if(flowPaused && used <= flowLowWater)
+    pauseSmuff(false);
+}
+
 void serialSmuffEvent() {
-  while (SerialSmuff.available()) {
-    int in = SerialSmuff.read();
-    if(in == -1)
+  checkFlowControl();
+  #if !defined(ESP32)
+    // the ISR sets these flags when its buffer overflowed or the UART saw garbage
+    if(SerialSmuff.hasOverrun())
+      rxOverruns++;
+    if(SerialSmuff.hasRxError())
+      rxErrors++;
+  #endif
+  int avail;
+  while ((avail = SerialSmuff.available()) > 0) {
+    // read straight into the ring buffer
+    BridgeRing::Span span = bufFromSMuFF.writable();
+    if(span.len == 0) {
+      rxOverflows++;
+      // in lossless mode the data stays in the UART buffer until the consumer catches up
+      if(flowLossless)
+        break;
+      SerialSmuff.read();
+      rxDropped++;
+      continue;
+    }
+    size_t len = SerialSmuff.read(span.data, min((size_t)avail, span.len));
+    if(len == 0)
       break;
-    
     #if defined(ESP32) && !defined(NOBT)
-      if(btConnections > 0)
-        SerialBT.write(in);
+      btBridgeData(span.data, len);
     #endif
-    bufFromSMuFF.lockedPush(in);
+    captureData(CAP_RX, span.data, len);
+    markArrival(len);
+    bufFromSMuFF.produce(len);
+    rxBytes += len;
+    checkFlowControl();
   }
 }
 
-#if defined(ESP32) && !defined(NOBT)
+size_t writeToSmuff(const uint8_t* data, size_t len) {
+    captureData(CAP_TX, data, len);
+    txBytes += len;
+    return SerialSmuff.write(data, len);
+}
 
-void serialBTEvent() {
-  while (SerialBT.available()) {
-    int in = SerialBT.read();
-    if(in == -1)
-      break;
-    SerialSmuff.write(in);
-  }
+size_t writeToSmuff(const char* data) {
+    return writeToSmuff((const uint8_t*)data, strlen(data));
 }
-#endif
 
-void getStringFromBuffer(String& ref) {
-    if(bufFromSMuFF.isEmpty()) {
-      ref.clear();
+void dispatchLine(const char* line, size_t len, const char* dbg, unsigned long* cntRef, bool sendWS) {
+    bool lineComplete = len > 0 && line[len-1] == '\n';
+
+    tcpBridgeData(line, len);
+    if(lineComplete && strncmp_P(line, cmdWI, 7) == 0) {
+      // handle specific commands, like for the SerialUART or NeoPixels
+      // see wi-control.md for details
+      char msg[CHUNK_SIZE+1];
+      memcpy(msg, line+7, len-7);
+      msg[len-7] = 0;
+      handleControlMessage(String(msg));
       return;
     }
-    bool stat = true;
-    do {
-      byte b;
-      if((stat = (bool)bufFromSMuFF.lockedPop(b))) {
-        if(b=='\n')
-          break;
-        ref += (char)b;
+    bool isStatus = lineComplete && statusSMuFF.update(line, len);
+    // replies to the WI-ESP's own commands don't go anywhere else
+    if(lineComplete && (baudrateLine(line, len) || smuffInfoLine(line, len)))
+      return;
+    // replies go to the client which has sent the command, before the "ok" retires it
+    int issuer = commandIssuer(line, len);
+    if(lineComplete)
+      commandQueueLine(line, len);
+    if(sendWS) {
+      if(isStatus)
+        sendStatusToWebsocket(line, len);
+      else {
+        replyClient = issuer;
+        if(latStamps && lineComplete && lineArrived != 0) {
+          // " @<µs>" tells apart time spent on the ESP from time spent on the WiFi
+          char stamped[CHUNK_SIZE+16];
+          int n = snprintf_P(stamped, ArraySize(stamped), PSTR("%.*s @%lu\n"), (int)len-1, line, (unsigned long)lineArrived);
+          sendToWebsocket(stamped, n);
+        }
+        else
+          sendToWebsocket(line, len);
+        replyClient = WS_BROADCAST;
       }
-      else
-        break;
-    } while (stat);
+    }
+    if(dbg != nullptr) {
+      __logS(PSTR("%s sent:"), dbg);
+      __logS(PSTR("%.*s"), (int)len, line);
+    }
+    if(lineComplete)
+      *cntRef += 1;
 }
 
-template<class T>
-void dumpBuffer(const T& buffer, String& ref, const char* dbg, unsigned long* cntRef, bool sendWS = false) {
-    if(buffer->isEmpty())
+template<class T, class F>
+void dumpBuffer(T& buffer, F& framer, const char* dbg, unsigned long* cntRef, bool sendWS = false) {
+    // frames are limited to CHUNK_SIZE to not overwhelm the internal buffers
+    size_t len = framer.scan(buffer);
+    if(len == 0)
       return;
-    bool stat = true;
-    bool lineComplete = false;
+    const char* line = framer.next(buffer, len);
+    lineArrived = lineArrival(len);
+    addLatency(latDispatch, lineArrived);
+    dispatchLine(line, len, dbg, cntRef, sendWS);
+    lineArrived = 0;
+    framer.release(buffer);
+}
 
-    if(dbg != nullptr)
-      __logS(PSTR("%s sent:"), dbg);
+#if defined(ESP32)
+void lockBridge() {
+  if(bridgeMutex != nullptr)
+    xSemaphoreTake(bridgeMutex, portMAX_DELAY);
+}
 
-    do {
-      byte b;
-      if((stat = (bool)buffer->lockedPop(b))) {
-        chunkSize--;
-        if(b=='\n') {
-          lineComplete = true;
-          break;
-        }
-        ref += (char)b;
-      }
+void unlockBridge() {
+  if(bridgeMutex != nullptr)
+    xSemaphoreGive(bridgeMutex);
+}
 
-      // send only data with the max. length of CHUNK_SIZE to not overwhelm the internal buffers
-      if(chunkSize == 0) {
-        if(sendWS)
-          sendToWebsocket(ref);
-        if(dbg != nullptr)
-          __logS(PSTR("%s"), ref.c_str());
-        chunkSize = CHUNK_SIZE;
-        ref = ref.substring(CHUNK_SIZE);
-      }
-      
-    } while (stat);
-
-    if(lineComplete) {
-      ref += "\n";
-      if(ref.startsWith(cmdWI)) {
-        // handle specific commands, like for the SerialUART or NeoPixels
-        // see wi-control.md for details
-        handleControlMessage(String(ref.substring(7)));
-        // __debugS(PSTR("%s"), ref.c_str());
-        ref.clear();
-        return;
-      }
-      if(sendWS && chunkSize != 0) {
-        sendToWebsocket(ref);
-        chunkSize = CHUNK_SIZE;
+void bridgeLoop(void* param) {
+  BridgeLine item;
+  for(;;) {
+    // woken up by the UART driver as soon as data has arrived
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BRIDGE_TASK_POLL));
+    lockBridge();
+    serialSmuffEvent();
+    for(;;) {
+      // leave the data in the ring buffer if loop() doesn't keep up
+      if(uxQueueSpacesAvailable(bridgeQueue) == 0) {
+        if(!bufFromSMuFF.isEmpty())
+          bridgeQueueFull++;
+        break;
       }
-      if(dbg != nullptr)
-        __logS(PSTR("%s"), ref.c_str());
-      ref.clear();
-      *cntRef += 1;
+      size_t len = framerSMuFF.scan(bufFromSMuFF);
+      if(len == 0)
+        break;
+      memcpy(item.data, framerSMuFF.next(bufFromSMuFF, len), len);
+      framerSMuFF.release(bufFromSMuFF);
+      item.len = len;
+      item.arrived = lineArrival(len);
+      item.data[len] = 0;
+      xQueueSend(bridgeQueue, &item, 0);
     }
+    unlockBridge();
+  }
 }
 
-void loop() { 
+void startBridgeTask() {
+  bridgeMutex = xSemaphoreCreateMutex();
+  bridgeQueue = xQueueCreate(BRIDGE_QUEUE_LEN, sizeof(BridgeLine));
+  if(xTaskCreatePinnedToCore(bridgeLoop, "bridge", BRIDGE_TASK_STACK, nullptr, BRIDGE_TASK_PRIO, &bridgeTask, BRIDGE_TASK_CORE) != pdPASS) {
+    __debugS(PSTR("Bridge task failed to start!"));
+    return;
+  }
+  SerialSmuff.onReceive([]() {
+    xTaskNotifyGive(bridgeTask);
+  });
+  __debugS(PSTR("Bridge task running on core %d"), BRIDGE_TASK_CORE);
+}
 
-  __systick = millis();           // for Adafruit NeoPixel library
+unsigned int getBridgeQueueDepth() {
+  return bridgeQueue != nullptr ? uxQueueMessagesWaiting(bridgeQueue) : 0;
+}
 
-  if(SerialSmuff.available()) {
-    serialSmuffEvent();
-  }
-  #if defined(ESP32) && !defined(NOBT)
-    if(SerialBT.available()) {
-      serialBTEvent();
+#else
+void lockBridge() {}
+void unlockBridge() {}
+#endif
+
+/*
+ * Takes the data from the SMuFF off the UART (or the bridge task) and
+ * dispatches it. Gets called before each scheduled task.
+ */
+void pollBridge() {
+  PROFILE_BEGIN();
+  #if defined(ESP32)
+    // serial and Bluetooth are handled by the bridge task on the other core
+    if(bridgeQueue != nullptr) {
+      BridgeLine item;
+      while(xQueueReceive(bridgeQueue, &item, 0) == pdTRUE) {
+        lineArrived = item.arrived;
+        addLatency(latDispatch, lineArrived);
+        dispatchLine(item.data, item.len, PSTR("SMuFF"), &smuffSent, true);
+        lineArrived = 0;
+      }
     }
+  #else
+    serialSmuffEvent();
+    PROFILE_STAGE(PROF_SERIAL);
+
+    if(!bufFromSMuFF.isEmpty())
+      dumpBuffer(bufFromSMuFF, framerSMuFF, PSTR("SMuFF"), &smuffSent, true);
   #endif
+  PROFILE_STAGE(PROF_DISPATCH);
+}
 
+void loopSmuff() {
+  loopBaudrate();
+  loopSmuffInfo();
+}
 
-  if(!bufFromSMuFF.isEmpty() && !isPinging)
-    dumpBuffer(&bufFromSMuFF, fromSMuFF, PSTR("SMuFF"), &smuffSent, true);
+void loopCommands() {
+  loopCmdQueue();
+  loopScript();
+}
 
-  loopWebserver();
-  
-  if(millis()-millisLast > 5000) {
-    millisLast = millis();
-    if(debugMemInfo)
-    #if defined(ESP32)
-      __debugS(PSTR("Heap: %u B"), ESP.getFreeHeap());
-    #else
-      __debugS(PSTR("Heap: %u B Stack: %u B"), ESP.getFreeHeap(), ESP.getFreeContStack());
-    #endif
-  }
-  
-  if(neoPixels != nullptr && numLeds > 0 && millis()- millisNpxRefresh > 50) {
+void loopRecorder() {
+  loopCapture();
+  loopReplay();
+}
+
+void loopHeapInfo() {
+  if(debugMemInfo)
+  #if defined(ESP32)
+    __debugS(PSTR("Heap: %u B"), ESP.getFreeHeap());
+  #else
+    __debugS(PSTR("Heap: %u B Stack: %u B"), ESP.getFreeHeap(), ESP.getFreeContStack());
+  #endif
+}
+
+void loopPixels() {
+  if(neoPixels != nullptr && numLeds > 0) {
     if(isPulsing)
       setNeoPixelPulsing();
     neoPixels->show();
-    millisNpxRefresh = millis();
+  }
+}
+
+void initScheduler() {
+  // name, function, period (ms, 0 = each pass), priority, profiler stage
+  scheduler.add("Web", loopWebserver, 0, 1, PROF_WEBSERVER);
+  scheduler.add("TCP", loopTcpBridge, 0, 1, PROF_WEBSERVER);
+  scheduler.add("Commands", loopCommands, 0, 1, PROF_HOUSEKEEPING);
+  #if defined(ESP32) && !defined(NOBT)
+    scheduler.add("BT", loopBtCommands, 0, 1, PROF_HOUSEKEEPING);
+  #endif
+  scheduler.add("Capture", loopRecorder, 0, 2, PROF_HOUSEKEEPING);
+  scheduler.add("SMuFF", loopSmuff, 10, 2, PROF_HOUSEKEEPING);
+  scheduler.add("UART", loopUartReceive, 5, 2, PROF_HOUSEKEEPING);
+  scheduler.add("Log", loopLog, 2, 3, PROF_HOUSEKEEPING);
+  scheduler.add("Pixels", loopPixels, 50, 3, PROF_PIXELS);
+  scheduler.add("WiFiMgr", loopWifiManager, 50, 4, PROF_WEBSERVER);
+  #if !defined(ESP32)
+    scheduler.add("mDNS", loopMDNS, 100, 4, PROF_WEBSERVER);
+  #endif
+  scheduler.add("Heap", loopHeapInfo, 5000, 5, PROF_HEAP);
+}
+
+void loop() { 
+
+  __systick = millis();           // for Adafruit NeoPixel library
+  loopIterations++;
+  if(__systick - loopRateMillis >= 1000) {
+    loopRate = (loopIterations - loopRateIterations) * 1000 / (__systick - loopRateMillis);
+    loopRateIterations = loopIterations;
+    loopRateMillis = __systick;
   }
 
+  // the bridge comes first, see Scheduler.h
+  pollBridge();
+  scheduler.run(pollBridge);
 }
 
 static char _dbg[2048];
@@ -286,7 +516,7 @@ static char _log[1024];
 int __debugESP(const char* fmt, va_list arguments) {
   int res = vsnprintf(_dbg, ArraySize(_dbg) - 1, fmt, arguments);
   if (debugToUART) {
-    SerialUART.println(_dbg);
+    logWrite(_dbg, true);
   }
   return res;
 }
@@ -300,10 +530,7 @@ void __debugS(const char* fmt, ...)
   va_end(arguments);
   if (debugToUART) {
     // SerialSmuff.printf("%cD%s%c",0x1B, _dbg, 0x1A);
-    if(strlen(_dbg) > 1 && _dbg[strlen(_dbg)-1] == '\r')
-      SerialUART.print(_dbg);
-    else
-      SerialUART.println(_dbg);
+    logWrite(_dbg, !(strlen(_dbg) > 1 && _dbg[strlen(_dbg)-1] == '\r'));
   }
 }
 
@@ -314,6 +541,6 @@ void __logS(const char* fmt, ...)
   vsnprintf_P(_log, ArraySize(_log) - 1, fmt, arguments);
   va_end(arguments);
   if (logToUART) {
-    SerialUART.println(_log);
+    logWrite(_log, true);
   }
 }
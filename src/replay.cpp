@@ -0,0 +1,151 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Replays the data received from the SMuFF in a capture file (see capture.cpp)
+ * through the bridge, as if it came from the UART: framing, dispatching and
+ * the WebSocket output path all see the recorded traffic, either at the
+ * recorded pace multiplied by a speed factor, or as fast as the bridge
+ * buffer takes it. Data sent to the SMuFF is skipped.
+ * Lines/s and the heap usage are reported at the end, so changes to the
+ * bridge can be compared on the bench, without a SMuFF attached.
+ */
+
+static File         replayFile;
+static bool         replaying = false;
+static uint16_t     replaySpeed;            // 0 = as fast as possible
+static CaptureRecord replayRec;
+static size_t       replayLeft = 0;         // bytes of replayRec still to be fed
+static uint32_t     replayFirst, replayStart;
+static unsigned long replayLines, replayBytes, replayRecords;
+static uint32_t     replayHeapStart, replayHeapMin, replayBlockMin;
+
+uint32_t getMaxFreeBlock() {
+    #if defined(ESP32)
+    return ESP.getMaxAllocHeap();
+    #else
+    return ESP.getMaxFreeBlockSize();
+    #endif
+}
+
+void sampleReplayHeap() {
+    uint32_t heap = ESP.getFreeHeap();
+    uint32_t block = getMaxFreeBlock();
+    if(heap < replayHeapMin)
+        replayHeapMin = heap;
+    if(block < replayBlockMin)
+        replayBlockMin = block;
+}
+
+bool startReplay(uint16_t speed) {
+    CaptureHeader hdr;
+    if(replaying || (captureOn && captureToFile))
+        return false;
+    replayFile = LittleFS.open(CAPTURE_FILE, "r");
+    if(!replayFile)
+        return false;
+    if(replayFile.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) ||
+       strncmp(hdr.magic, "SMCP", 4) != 0 || hdr.version != CAPTURE_VERSION) {
+        replayFile.close();
+        return false;
+    }
+    replaySpeed = speed;
+    replayLeft = 0;
+    replayFirst = 0;
+    replayRecords = replayBytes = 0;
+    replayLines = smuffSent;
+    replayHeapStart = replayHeapMin = ESP.getFreeHeap();
+    replayBlockMin = getMaxFreeBlock();
+    replayStart = micros();
+    replaying = true;
+    __debugS(PSTR("Replaying %s (%u B, speed %u)"), CAPTURE_FILE, replayFile.size(), speed);
+    return true;
+}
+
+void getReplayState(char* buf, size_t len) {
+    uint32_t elapsed = (micros() - replayStart) / 1000;
+    unsigned long lines = smuffSent - replayLines;
+    snprintf_P(buf, len, PSTR("Replay %s: %lu records, %lu B, %lu lines in %lu ms (%lu lines/s), heap min. %u B (%u B at start), max. block min. %u B"),
+        replaying ? "running" : "finished",
+        replayRecords,
+        replayBytes,
+        lines,
+        (unsigned long)elapsed,
+        elapsed > 0 ? (unsigned long)((uint64_t)lines * 1000 / elapsed) : 0,
+        replayHeapMin,
+        replayHeapStart,
+        replayBlockMin);
+}
+
+void stopReplay() {
+    char tmp[200];
+    if(!replaying)
+        return;
+    replayFile.close();
+    replaying = false;
+    getReplayState(tmp, ArraySize(tmp));
+    sendResponse(PSTR("%s"), tmp);
+}
+
+/*
+ * Reads the next record header, skipping the data sent to the SMuFF.
+ * Returns false at the end of the file.
+ */
+bool nextReplayRecord() {
+    while(replayFile.read((uint8_t*)&replayRec, sizeof(replayRec)) == sizeof(replayRec)) {
+        if(replayRecords++ == 0)
+            replayFirst = replayRec.micros;
+        if(replayRec.dir == CAP_RX) {
+            replayLeft = replayRec.len;
+            return true;
+        }
+        replayFile.seek(replayRec.len, SeekCur);
+    }
+    return false;
+}
+
+void loopReplay() {
+    if(!replaying)
+        return;
+    sampleReplayHeap();
+    if(replayLeft == 0 && !nextReplayRecord()) {
+        // let the bridge drain before reporting
+        if(bufFromSMuFF.isEmpty())
+            stopReplay();
+        return;
+    }
+    if(replaySpeed > 0 && (replayRec.micros - replayFirst) / replaySpeed > micros() - replayStart)
+        return;
+    // on ESP32 the bridge task is the producer of the ring buffer otherwise
+    lockBridge();
+    BridgeRing::Span span = bufFromSMuFF.writable();
+    if(span.len == 0) {
+        unlockBridge();
+        return;
+    }
+    size_t len = replayFile.read(span.data, min(replayLeft, span.len));
+    if(len > 0)
+        markArrival(len);
+    bufFromSMuFF.produce(len);
+    unlockBridge();
+    // a truncated record ends the replay
+    replayLeft = len > 0 ? replayLeft - len : 0;
+    replayBytes += len;
+}
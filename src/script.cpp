@@ -0,0 +1,165 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Streams a command file from LittleFS (uploaded via /uploadScript) to the
+ * SMuFF. The lines are fed into the command queue one at a time, whenever
+ * the window has room, hence the SMuFF's "ok" paces the script and
+ * pausing or aborting takes effect after the commands already in flight.
+ * Empty lines and comments (starting with ';') are skipped, lines longer
+ * than CHUNK_SIZE abort the script.
+ */
+
+#define SCRIPT_PROGRESS_INTERVAL    1000    // ms between progress reports
+
+typedef enum {
+    SCRIPT_IDLE = 0,
+    SCRIPT_RUNNING,
+    SCRIPT_PAUSED,
+    SCRIPT_DRAINING                         // end of file reached, waiting for the last "ok"
+} ScriptState;
+
+static File         scriptFile;
+static ScriptState  scriptState = SCRIPT_IDLE;
+static char         scriptName[32];
+static size_t       scriptSize, scriptPos;
+static unsigned long scriptLines, scriptLineNo;
+static uint32_t     scriptStart, scriptReported;
+
+void reportScript(const char* state) {
+    sendResponse(PSTR("Script %s %s: %u%% (%lu lines, %lu s)"),
+        scriptName,
+        state,
+        scriptSize > 0 ? (unsigned)(scriptPos * 100 / scriptSize) : 100,
+        scriptLines,
+        (millis() - scriptStart) / 1000);
+    scriptReported = millis();
+}
+
+bool runScript(const char* name) {
+    char path[40];
+    if(scriptState != SCRIPT_IDLE || cmdWindow == 0)
+        return false;
+    snprintf_P(path, ArraySize(path), PSTR(SCRIPT_DIR "/%s"), name);
+    scriptFile = LittleFS.open(path, "r");
+    if(!scriptFile)
+        return false;
+    scriptFile.setTimeout(0);               // don't wait for more data on a last line without newline
+    strncpy(scriptName, name, ArraySize(scriptName)-1);
+    scriptName[ArraySize(scriptName)-1] = 0;
+    scriptSize = scriptFile.size();
+    scriptPos = 0;
+    scriptLines = 0;
+    scriptLineNo = 0;
+    scriptStart = millis();
+    scriptReported = scriptStart;
+    scriptState = SCRIPT_RUNNING;
+    __debugS(PSTR("Running script %s (%u B)"), path, scriptSize);
+    return true;
+}
+
+bool pauseScript(bool pause) {
+    if(pause && scriptState == SCRIPT_RUNNING)
+        scriptState = SCRIPT_PAUSED;
+    else if(!pause && scriptState == SCRIPT_PAUSED)
+        scriptState = SCRIPT_RUNNING;
+    else
+        return false;
+    reportScript(pause ? "paused" : "resumed");
+    return true;
+}
+
+bool isScriptRunning() {
+    return scriptState != SCRIPT_IDLE;
+}
+
+bool abortScript() {
+    if(scriptState == SCRIPT_IDLE)
+        return false;
+    scriptFile.close();
+    scriptState = SCRIPT_IDLE;
+    reportScript("aborted");
+    return true;
+}
+
+void getScriptState(char* buf, size_t len) {
+    static const char* states[] = { "idle", "running", "paused", "finishing" };
+    if(scriptState == SCRIPT_IDLE) {
+        snprintf_P(buf, len, PSTR("No script running."));
+        return;
+    }
+    snprintf_P(buf, len, PSTR("Script %s %s: %u of %u B, %lu lines, %lu s"),
+        scriptName,
+        states[scriptState],
+        scriptPos,
+        scriptSize,
+        scriptLines,
+        (millis() - scriptStart) / 1000);
+}
+
+void loopScript() {
+    switch(scriptState) {
+        case SCRIPT_IDLE:
+        case SCRIPT_PAUSED:
+            return;
+
+        case SCRIPT_RUNNING:
+            // keep the queue shallow, so pause and abort don't lag behind
+            while(cmdPending == 0 && cmdInFlight < cmdWindow) {
+                char line[CHUNK_SIZE+1];
+                if(!scriptFile.available()) {
+                    scriptFile.close();
+                    scriptState = SCRIPT_DRAINING;
+                    break;
+                }
+                size_t len = scriptFile.readBytesUntil('\n', line, ArraySize(line)-1);
+                scriptLineNo++;
+                if(len == ArraySize(line)-1 && scriptFile.available()) {
+                    // readBytesUntil() stops at the max. length without consuming the newline
+                    if(scriptFile.peek() != '\n') {
+                        scriptFile.close();
+                        scriptState = SCRIPT_IDLE;
+                        sendResponse(PSTR("Script %s aborted: line %lu is longer than %d characters."), scriptName, scriptLineNo, CHUNK_SIZE);
+                        return;
+                    }
+                    scriptFile.read();
+                }
+                scriptPos = scriptFile.position();
+                while(len > 0 && (line[len-1] == '\r' || line[len-1] == ' '))
+                    len--;
+                if(len == 0 || line[0] == ';')
+                    continue;
+                line[len++] = '\n';
+                queueCommands(line, len);
+                scriptLines++;
+            }
+            break;
+
+        case SCRIPT_DRAINING:
+            if(cmdPending == 0 && cmdInFlight == 0) {
+                scriptState = SCRIPT_IDLE;
+                reportScript("finished");
+                return;
+            }
+            break;
+    }
+    if(millis() - scriptReported >= SCRIPT_PROGRESS_INTERVAL)
+        reportScript("running");
+}
@@ -0,0 +1,146 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Detects the SMuFF and its firmware version for /info without blocking:
+ * a probe (M115) gets sent at startup, after the SMuFF has been reset and
+ * whenever /info is requested while the cached version is older than the
+ * TTL. The reply is picked up from the bridged data (see SmuffStatus) and
+ * not forwarded to the WebSocket client, just like before.
+ */
+
+#define INFO_PROBE_CMD      "M115\n"
+#define INFO_PROBE_TIMEOUT  1000    // ms
+#define INFO_START_DELAY    2000    // ms to wait after the SMuFF has sent "start"
+#define INFO_TTL            600000  // ms a detected firmware version is considered valid
+#define INFO_RETRY          5000    // ms between probes if no SMuFF was found
+
+typedef enum {
+    INFO_IDLE = 0,
+    INFO_DELAY,
+    INFO_PROBE,
+    INFO_ACK
+} InfoState;
+
+static InfoState    infoState = INFO_IDLE;
+static bool         infoValid = false, infoProbed = false;
+static uint32_t     infoMillis, infoFetched;
+static unsigned long infoResets = 0;
+unsigned long       infoProbes = 0, infoCacheHits = 0;
+
+void startInfoProbe() {
+    writeToSmuff(INFO_PROBE_CMD);
+    infoMillis = millis();
+    infoState = INFO_PROBE;
+    infoProbes++;
+}
+
+void initSmuffInfo() {
+    infoMillis = millis();
+    infoState = INFO_DELAY;
+}
+
+/*
+ * Gets called by the /info handler; it never waits for the SMuFF.
+ * Requests arriving while a probe is running share its result. While the
+ * baudrate gets switched, the SMuFF isn't probed (the switch verifies the
+ * new rate with a probe of its own), the last result is reported then.
+ */
+void requestSmuffInfo() {
+    uint32_t now = millis();
+    if(infoState != INFO_IDLE || isBaudSwitching())
+        return;
+    if(infoValid && now - infoFetched < INFO_TTL) {
+        infoCacheHits++;
+        return;
+    }
+    if(!infoValid && infoProbed && now - infoFetched < INFO_RETRY)
+        return;
+    startInfoProbe();
+}
+
+void getSmuffInfo(char* buf, size_t len) {
+    if(infoValid)
+        snprintf_P(buf, len, PSTR("SMuFF %s attached."), statusSMuFF.firmware);
+    else if(!infoProbed)
+        snprintf_P(buf, len, PSTR("Detecting SMuFF..."));
+    else
+        snprintf_P(buf, len, PSTR("No SMuFF attached."));
+}
+
+bool isInfoProbing() {
+    return infoState == INFO_PROBE || infoState == INFO_ACK;
+}
+
+/*
+ * Gets called for each complete line received from the SMuFF.
+ * Returns true if the line was the reply to the probe.
+ */
+bool smuffInfoLine(const char* line, size_t len) {
+    if(infoState == INFO_PROBE && len >= 13 && strncmp_P(line, PSTR("FIRMWARE_NAME"), 13) == 0) {
+        infoValid = statusSMuFF.firmware[0] != 0;
+        infoProbed = true;
+        infoFetched = millis();
+        infoMillis = infoFetched;
+        infoState = INFO_ACK;
+        __debugS(PSTR("SMuFF responded with version %s"), statusSMuFF.firmware);
+        return true;
+    }
+    if(infoState == INFO_ACK && len >= 2 && strncmp_P(line, PSTR("ok"), 2) == 0) {
+        infoState = INFO_IDLE;
+        return true;
+    }
+    return false;
+}
+
+void loopSmuffInfo() {
+    uint32_t now = millis();
+
+    if(statusSMuFF.resets != infoResets) {
+        // the SMuFF might have got a new firmware
+        infoResets = statusSMuFF.resets;
+        infoMillis = now;
+        infoState = INFO_DELAY;
+    }
+
+    switch(infoState) {
+        case INFO_IDLE:
+            break;
+
+        case INFO_DELAY:
+            if(now - infoMillis > INFO_START_DELAY && !isBaudSwitching())
+                startInfoProbe();
+            break;
+
+        case INFO_PROBE:
+            if(now - infoMillis > INFO_PROBE_TIMEOUT) {
+                infoValid = false;
+                infoProbed = true;
+                infoFetched = now;
+                infoState = INFO_IDLE;
+            }
+            break;
+
+        case INFO_ACK:
+            if(now - infoMillis > INFO_PROBE_TIMEOUT)
+                infoState = INFO_IDLE;
+            break;
+    }
+}
@@ -0,0 +1,206 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+#if defined(ESP32)
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#else
+#include <ESP8266WiFi.h>
+#endif
+
+/*
+ * Plain TCP access to the SMuFF's serial stream for host software, i.e.
+ *
+ *   nc <wi-esp> 2323   or   telnet <wi-esp> 2323
+ *
+ * Everything the SMuFF sends is written to the clients as it comes out of
+ * the bridge buffer (see dispatchLine()). Lines from the clients go through
+ * the command queue like the ones from the WebSocket clients, hence both
+ * can be used at the same time; the SMuFF's replies to them aren't sent to
+ * the WebSocket clients. Telnet option negotiation (IAC ...) is skipped,
+ * the serial settings can't be changed from here (use SYS:BAUD).
+ */
+
+#define TCP_MAX_CLIENTS     2
+#define TELNET_IAC          0xFF
+#define TELNET_SB           0xFA
+#define TELNET_SE           0xF0
+
+typedef struct {
+    WiFiClient      client;
+    char            line[CHUNK_SIZE+1];
+    size_t          len;
+    uint8_t         iac;                // bytes of a telnet command still to be skipped
+    bool            sub;                // within a telnet subnegotiation
+} TcpClient;
+
+static WiFiServer   tcpServer(TCP_BRIDGE_PORT);
+static TcpClient    tcpClients[TCP_MAX_CLIENTS];
+int                 tcpClientsConnected = 0;
+unsigned long       tcpRxBytes = 0, tcpTxBytes = 0, tcpDropped = 0, tcpRejected = 0;
+
+void initTcpBridge() {
+    tcpServer.begin();
+    tcpServer.setNoDelay(true);
+    __debugS(PSTR("TCP bridge listening on port %d"), TCP_BRIDGE_PORT);
+}
+
+#if defined(ESP32)
+/*
+ * The ESP32's WiFiClient has no availableForWrite() and its write() retries
+ * until the client's timeout while the send buffer is full, so the socket
+ * is used directly. lwIP reports it writable as long as more than
+ * TCP_SNDLOWAT bytes (about half the send buffer) are free, which is more
+ * than a line or a batch of the WebSocket server (see WsServer).
+ */
+bool canWriteTcp(WiFiClient& client, size_t len) {
+    int fd = client.fd();
+    if(fd < 0)
+        return false;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    struct timeval tv = { 0, 0 };
+    return select(fd + 1, nullptr, &fds, nullptr, &tv) > 0;
+}
+
+size_t writeTcp(WiFiClient& client, const uint8_t* data, size_t len) {
+    int sent = send(client.fd(), data, len, MSG_DONTWAIT);
+    return sent > 0 ? (size_t)sent : 0;
+}
+#else
+bool canWriteTcp(WiFiClient& client, size_t len) {
+    return (size_t)client.availableForWrite() >= len;
+}
+
+size_t writeTcp(WiFiClient& client, const uint8_t* data, size_t len) {
+    return client.write(data, len);
+}
+#endif
+
+/*
+ * Gets called with the data received from the SMuFF.
+ */
+void tcpBridgeData(const char* data, size_t len) {
+    if(tcpClientsConnected == 0)
+        return;
+    for(uint8_t i = 0; i < TCP_MAX_CLIENTS; i++) {
+        WiFiClient& client = tcpClients[i].client;
+        if(!client || !client.connected())
+            continue;
+        // don't wait for a client which doesn't keep up
+        if(!canWriteTcp(client, len)) {
+            tcpDropped += len;
+            continue;
+        }
+        size_t sent = writeTcp(client, (const uint8_t*)data, len);
+        tcpTxBytes += sent;
+        tcpDropped += len - sent;
+    }
+}
+
+void queueTcpLine(TcpClient& tc) {
+    if(tc.len == 0)
+        return;
+    queueCommands(tc.line, tc.len, TCP_ISSUER);
+    tc.len = 0;
+}
+
+/*
+ * Assembles the bytes received into lines, skipping telnet commands.
+ */
+void readTcpClient(TcpClient& tc) {
+    uint8_t buf[64];
+    int avail;
+    while((avail = tc.client.available()) > 0) {
+        size_t len = tc.client.read(buf, min((size_t)avail, sizeof(buf)));
+        if(len == 0)
+            break;
+        tcpRxBytes += len;
+        for(size_t n = 0; n < len; n++) {
+            uint8_t c = buf[n];
+            if(tc.iac > 0) {
+                // IAC <cmd> [<option>]
+                if(tc.iac == 2 && c == TELNET_SB)
+                    tc.sub = true;
+                else if(tc.iac == 2 && c == TELNET_SE)
+                    tc.sub = false;
+                tc.iac = tc.iac == 2 && c >= 0xFB && c != TELNET_IAC ? 1 : 0;
+                continue;
+            }
+            if(c == TELNET_IAC) {
+                tc.iac = 2;
+                continue;
+            }
+            if(tc.sub || c == '\r' || c == 0)
+                continue;
+            tc.line[tc.len++] = (char)c;
+            if(c == '\n' || tc.len >= CHUNK_SIZE)
+                queueTcpLine(tc);
+        }
+    }
+}
+
+void loopTcpBridge() {
+    if(tcpServer.hasClient()) {
+        WiFiClient client = tcpServer.available();
+        uint8_t i;
+        for(i = 0; i < TCP_MAX_CLIENTS; i++) {
+            if(!tcpClients[i].client || !tcpClients[i].client.connected())
+                break;
+        }
+        if(i < TCP_MAX_CLIENTS) {
+            client.setNoDelay(true);
+            tcpClients[i].client = client;
+            tcpClients[i].len = 0;
+            tcpClients[i].iac = 0;
+            tcpClients[i].sub = false;
+            __debugS(PSTR("TCP client #%u connected from %s"), i, client.remoteIP().toString().c_str());
+        }
+        else {
+            tcpRejected++;
+            client.stop();
+        }
+    }
+    int connected = 0;
+    for(uint8_t i = 0; i < TCP_MAX_CLIENTS; i++) {
+        TcpClient& tc = tcpClients[i];
+        if(!tc.client)
+            continue;
+        if(!tc.client.connected()) {
+            __debugS(PSTR("TCP client #%u disconnected"), i);
+            tc.client.stop();
+            tc.client = WiFiClient();
+            continue;
+        }
+        readTcpClient(tc);
+        connected++;
+    }
+    tcpClientsConnected = connected;
+}
+
+int getTcpStats(char* buf, size_t len) {
+    return snprintf_P(buf, len, PSTR("TCP clients:\t%d (port %d), %lu rejected\nTCP traffic:\t%lu B in, %lu B out, %lu B dropped\n"),
+        tcpClientsConnected,
+        TCP_BRIDGE_PORT,
+        tcpRejected,
+        tcpRxBytes,
+        tcpTxBytes,
+        tcpDropped);
+}
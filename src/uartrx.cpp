@@ -0,0 +1,82 @@
+/**
+ * SMuFF WI-ESP Firmware
+ * Copyright (C) 2024 Technik Gegg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "Config.h"
+
+/*
+ * Receives the data of a device attached to the spare UART (i.e. a filament
+ * sensor). The UART's interrupt driven buffer (UART_RX_BUFSIZE) gets emptied
+ * into a ring buffer, from which complete lines are sent to the WebSocket
+ * clients which have subscribed to them (UART:RECEIVE:ON), prefixed with
+ * "echo: UART: ", so they don't get mixed up with the SMuFF's output.
+ */
+
+#define UART_RING_SIZE      512     // must be a power of two
+
+typedef SpscRing<byte, UART_RING_SIZE> UartRing;
+
+static UartRing     uartRing;
+static LineFramer<UartRing, CHUNK_SIZE> uartFramer;
+unsigned long       uartRxBytes = 0, uartRxLines = 0, uartRxOverflows = 0, uartRxDropped = 0;
+
+#if defined(ESP32)
+void serialUartError(hardwareSerial_error_t err) {
+    if(err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR)
+        uartRxOverflows++;
+}
+#endif
+
+void loopUartReceive() {
+    #if !defined(ESP32)
+    if(SerialUART.overflow())
+        uartRxOverflows++;
+    #endif
+    int avail;
+    while((avail = SerialUART.available()) > 0) {
+        UartRing::Span span = uartRing.writable();
+        if(span.len == 0) {
+            // nobody reads the lines fast enough, keep the older ones
+            SerialUART.read();
+            uartRxDropped++;
+            continue;
+        }
+        size_t len = SerialUART.readBytes(span.data, min((size_t)avail, span.len));
+        if(len == 0)
+            break;
+        uartRing.produce(len);
+        uartRxBytes += len;
+    }
+    size_t len;
+    while((len = uartFramer.scan(uartRing)) > 0) {
+        const char* line = uartFramer.next(uartRing, len);
+        sendUartToWebsocket(line, len);
+        uartFramer.release(uartRing);
+        uartRxLines++;
+    }
+}
+
+int getUartStats(char* buf, size_t len) {
+    return snprintf_P(buf, len, PSTR("UART received:\t%lu B, %lu lines\nUART overflows:\t%lu (driver), %lu B dropped, buffer max. %u/%u B\nUART subscribers:\t%d"),
+        uartRxBytes,
+        uartRxLines,
+        uartRxOverflows,
+        uartRxDropped,
+        uartRing.getHighWater(),
+        uartRing.capacity(),
+        getUartSubscribers());
+}
@@ -42,16 +42,74 @@ HTTPUpdateServer        httpUpdateServer;
 ESP8266WebServer        webServer(80);
 ESP8266HTTPUpdateServer httpUpdateServer(true);
 #endif
-WebSocketsServer        webSocketServer = WebSocketsServer(8080);
+#define WS_CLIENT_QUEUE 2048        // bytes buffered for a client which can't keep up (power of two, > a full batch)
+#define WS_SUMMARY_MS   2000        // ms behind until a client gets status reports and replies only...
+#define WS_EVICT_MS     10000       // ...and until it gets disconnected
+#define WS_SLOW_WRITE   20          // ms a write may take until the client counts as congested...
+#define WS_BACKOFF_MS   200         // ...and doesn't get written to directly for this long
+#define WS_PING_MS      15000       // heartbeat, detects clients which have gone silently
+#define WS_PONG_MS      3000
+#define WS_PONG_MISSES  2
+
+/*
+ * Gives access to the TCP connection of the clients, so data is
+ * only written if it fits into the send buffer without blocking
+ * (see canWriteTcp() in tcpbridge.cpp).
+ */
+class WsServer : public WebSocketsServer {
+public:
+    WsServer(uint16_t port) : WebSocketsServer(port) {}
+
+    bool canWrite(uint8_t num, size_t len) {
+        return _clients[num].tcp != nullptr && canWriteTcp(*_clients[num].tcp, len);
+    }
+};
+
+typedef SpscRing<uint8_t, WS_CLIENT_QUEUE> WsQueue;
+
+typedef struct {
+    bool            connected;
+    bool            binary;                 // status reports as StatusRecord
+    bool            uart;                   // gets the lines received on the spare UART
+    bool            summary;                // fell behind, gets status reports and replies only
+    WsQueue*        queue;                  // frames waiting to be written (allocated while connected)
+    uint32_t        behindSince;            // millis() since frames are waiting, 0 = up to date
+    uint32_t        backoffUntil;
+    unsigned long   queued, dropped, slowWrites;
+    size_t          queuePeak;
+} WsClient;
+
+WsServer                webSocketServer(8080);
 char                    deviceName[50];
 int                     wsClientsConnected = 0;
-int                     curClient = -1;
+WsClient                wsClients[WEBSOCKETS_SERVER_CLIENT_MAX];
+int                     replyClient = WS_BROADCAST;     // receiver of what gets sent right now
 
 String                  updaterError;
 uint32_t                uploadSize = 0;
 uint8_t                 lastPercent;
 
 #define WS_CHUNK_SIZE   256
+#define WS_BATCH_SIZE   1024
+
+static_assert(WS_CLIENT_QUEUE >= 2 * WS_BATCH_SIZE, "a client's queue must hold a full batch with its 3 byte header and then some");
+
+// lines coalesced into one frame, with room for the frame header in front, so
+// the library neither allocates nor copies when sending it to several clients
+uint8_t                 wsFrame[WEBSOCKETS_MAX_HEADER_SIZE + WS_BATCH_SIZE];
+#define wsBatch         ((char*)&wsFrame[WEBSOCKETS_MAX_HEADER_SIZE])
+size_t                  wsBatchLen = 0;
+int                     wsBatchTarget = WS_BROADCAST;
+uint32_t                wsBatchStart;
+uint32_t                wsBatchArrived;             // arrival of the first line in the batch (see latency.cpp)
+uint16_t                wsBatchBudget = 0;              // ms; 0 = each line goes out as a frame of its own
+uint16_t                wsBatchLimit = WS_BATCH_SIZE;
+unsigned long           wsMessages = 0, wsFrames = 0, wsBytes = 0;
+unsigned long           wsMessageRate = 0, wsFrameRate = 0;
+unsigned long           wsRateMessages = 0, wsRateFrames = 0;
+uint32_t                wsRateMillis = 0;
+unsigned long           wsBinaryRecords = 0, wsBinarySaved = 0;
+unsigned long           wsDowngrades = 0, wsEvictions = 0;
 
 static const char updateBinaryPage[] PROGMEM = {
      R"(<!DOCTYPE html>
@@ -79,6 +137,13 @@ void sendResponse(int status, const char* mime, String value) {
     webServer.send(status, mime, value);
 }
 
+// values in 1/10 units as sent by the SMuFF, null if not reported yet
+int jsonTenths(char* buf, size_t len, int16_t value) {
+    if(value == STATUS_NO_VALUE)
+        return snprintf_P(buf, len, PSTR("null"));
+    return snprintf_P(buf, len, PSTR("%s%d.%d"), value < 0 ? "-" : "", abs(value) / 10, abs(value) % 10);
+}
+
 void sendOkResponse() {
     sendResponse(200, MIME_TEXT, String("ok"));
 }
@@ -110,6 +175,167 @@ void setUpdaterError() {
 #endif
 }
 
+/*
+ * Writes /metrics (Prometheus text format) in chunks from a small buffer,
+ * so scraping neither builds a String nor depends on the number of metrics.
+ */
+class MetricsWriter {
+
+private:
+    char    buf[256];
+    size_t  len = 0;
+
+public:
+    void flush() {
+        if(len > 0)
+            webServer.sendContent(buf, len);
+        len = 0;
+    }
+
+    void printf_P(const char* fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf_P(buf+len, sizeof(buf)-len, fmt, args);
+        va_end(args);
+        if(n >= 0 && len + n >= sizeof(buf)) {
+            flush();
+            va_start(args, fmt);
+            n = vsnprintf_P(buf, sizeof(buf), fmt, args);
+            va_end(args);
+        }
+        if(n > 0)
+            len = min(len + n, sizeof(buf)-1);
+    }
+
+    void metric(const char* name, const char* type, const char* help) {
+        printf_P(PSTR("# HELP smuffwi_%s %s\n# TYPE smuffwi_%s %s\n"), name, help, name, type);
+    }
+
+    void value(const char* name, const char* labels, unsigned long value) {
+        printf_P(PSTR("smuffwi_%s%s %lu\n"), name, labels, value);
+    }
+
+    void counter(const char* name, const char* help, unsigned long val) {
+        metric(name, PSTR("counter"), help);
+        value(name, "", val);
+    }
+
+    void gauge(const char* name, const char* help, long val) {
+        metric(name, PSTR("gauge"), help);
+        printf_P(PSTR("smuffwi_%s %ld\n"), name, val);
+    }
+};
+
+void sendMetrics() {
+    MetricsWriter out;
+    size_t queued = 0;
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(wsClients[i].connected && wsClients[i].queue != nullptr)
+            queued += wsClients[i].queue->size();
+    }
+    #if defined(ESP32)
+    uint32_t heapFree = ESP.getFreeHeap();
+    uint32_t heapBlock = ESP.getMaxAllocHeap();
+    uint8_t heapFrag = heapFree > 0 ? 100 - (uint8_t)((uint64_t)heapBlock * 100 / heapFree) : 0;
+    #else
+    uint32_t heapFree = ESP.getFreeHeap();
+    uint32_t heapBlock = ESP.getMaxFreeBlockSize();
+    uint8_t heapFrag = ESP.getHeapFragmentation();
+    #endif
+
+    webServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    sendResponse(200, MIME_METRICS, String());
+    out.metric(PSTR("bytes_total"), PSTR("counter"), PSTR("Bytes exchanged with the SMuFF"));
+    out.value(PSTR("bytes_total"), "{dir=\"rx\"}", rxBytes);
+    out.value(PSTR("bytes_total"), "{dir=\"tx\"}", txBytes);
+    out.metric(PSTR("lines_total"), PSTR("counter"), PSTR("Lines received from the SMuFF (rx), commands sent to it (tx) and lines sent over Bluetooth (bt)"));
+    out.value(PSTR("lines_total"), "{dir=\"rx\"}", smuffSent);
+    out.value(PSTR("lines_total"), "{dir=\"tx\"}", wiSent);
+    out.value(PSTR("lines_total"), "{dir=\"bt\"}", btSent);
+    #if defined(ESP32) && !defined(NOBT)
+    out.metric(PSTR("bt_bytes_total"), PSTR("counter"), PSTR("Bytes sent to (tx) and received from (rx) the Bluetooth client"));
+    out.value(PSTR("bt_bytes_total"), "{dir=\"tx\"}", btTxBytes);
+    out.value(PSTR("bt_bytes_total"), "{dir=\"rx\"}", btRxBytes);
+    out.counter(PSTR("bt_dropped_bytes_total"), PSTR("Bytes dropped because the Bluetooth client didn't keep up"), btTxDropped);
+    out.gauge(PSTR("bt_queued_bytes"), PSTR("Bytes waiting to be sent to the Bluetooth client"), getBtQueueDepth());
+    out.gauge(PSTR("bt_clients"), PSTR("Bluetooth clients connected"), btConnections);
+    #endif
+    out.gauge(PSTR("ring_used_bytes"), PSTR("Fill level of the bridge ring buffer"), bufFromSMuFF.size());
+    out.gauge(PSTR("ring_high_water_bytes"), PSTR("Highest fill level of the bridge ring buffer"), bufFromSMuFF.getHighWater());
+    out.gauge(PSTR("ring_size_bytes"), PSTR("Size of the bridge ring buffer"), bufFromSMuFF.capacity());
+    out.counter(PSTR("ring_overflows_total"), PSTR("Reads from the UART which found the bridge buffer full"), rxOverflows);
+    out.counter(PSTR("rx_dropped_bytes_total"), PSTR("Bytes dropped because the bridge buffer was full"), rxDropped);
+    out.counter(PSTR("rx_overruns_total"), PSTR("UART receive overruns"), rxOverruns);
+    out.counter(PSTR("rx_errors_total"), PSTR("UART receive errors"), rxErrors);
+    out.gauge(PSTR("ws_clients"), PSTR("WebSocket clients connected"), wsClientsConnected);
+    out.gauge(PSTR("ws_queued_bytes"), PSTR("Bytes queued for slow WebSocket clients"), queued);
+    out.counter(PSTR("ws_frames_total"), PSTR("WebSocket frames sent"), wsFrames);
+    out.counter(PSTR("ws_sent_bytes_total"), PSTR("WebSocket payload bytes sent"), wsBytes);
+    out.gauge(PSTR("tcp_clients"), PSTR("Raw TCP bridge clients connected"), tcpClientsConnected);
+    out.metric(PSTR("tcp_bytes_total"), PSTR("counter"), PSTR("Bytes received from (rx) and sent to (tx) the raw TCP bridge clients"));
+    out.value(PSTR("tcp_bytes_total"), "{dir=\"rx\"}", tcpRxBytes);
+    out.value(PSTR("tcp_bytes_total"), "{dir=\"tx\"}", tcpTxBytes);
+    out.counter(PSTR("tcp_dropped_bytes_total"), PSTR("Bytes dropped because a TCP client didn't keep up"), tcpDropped);
+    out.counter(PSTR("uart_rx_bytes_total"), PSTR("Bytes received on the spare UART"), uartRxBytes);
+    out.counter(PSTR("uart_rx_lines_total"), PSTR("Lines received on the spare UART"), uartRxLines);
+    out.counter(PSTR("uart_rx_overflows_total"), PSTR("Receive buffer overflows of the spare UART driver"), uartRxOverflows);
+    out.counter(PSTR("uart_rx_dropped_bytes_total"), PSTR("Bytes dropped because the spare UART's line buffer was full"), uartRxDropped);
+    out.counter(PSTR("log_messages_total"), PSTR("Debug/log messages queued for the UART"), logQueued);
+    out.counter(PSTR("log_dropped_total"), PSTR("Debug/log messages dropped because the UART didn't keep up"), logDropped);
+    out.counter(PSTR("log_dropped_bytes_total"), PSTR("Bytes of the debug/log messages dropped"), logDroppedBytes);
+    out.counter(PSTR("ws_evictions_total"), PSTR("WebSocket clients disconnected for being too slow"), wsEvictions);
+    out.counter(PSTR("cmd_timeouts_total"), PSTR("Commands the SMuFF didn't acknowledge in time"), cmdTimeouts);
+    out.gauge(PSTR("heap_free_bytes"), PSTR("Free heap"), heapFree);
+    out.gauge(PSTR("heap_max_block_bytes"), PSTR("Largest free heap block"), heapBlock);
+    out.gauge(PSTR("heap_fragmentation_percent"), PSTR("Heap fragmentation"), heapFrag);
+    out.counter(PSTR("loop_iterations_total"), PSTR("Main loop iterations"), loopIterations);
+    out.gauge(PSTR("loop_rate"), PSTR("Main loop iterations per second"), loopRate);
+    out.gauge(PSTR("wifi_rssi_dbm"), PSTR("WiFi signal strength"), WiFi.RSSI());
+    out.gauge(PSTR("uptime_seconds"), PSTR("Time since boot"), millis() / 1000);
+    out.flush();
+    webServer.sendContent("", 0);           // ends the chunked response
+}
+
+static bool scriptUploadFailed = false;
+
+void handleScriptUpload() {
+    static File uploadFile;
+    HTTPUpload& upload = webServer.upload();
+    char path[40];
+
+    switch(upload.status) {
+        case UPLOAD_FILE_START:
+            if(!LittleFS.exists(SCRIPT_DIR))
+                LittleFS.mkdir(SCRIPT_DIR);
+            snprintf_P(path, ArraySize(path), PSTR(SCRIPT_DIR "/%s"), upload.filename.c_str());
+            uploadFile = LittleFS.open(path, "w");
+            scriptUploadFailed = !uploadFile;
+            if(scriptUploadFailed)
+                __debugS(PSTR("Script upload failed, can't create %s"), path);
+            else
+                __debugS(PSTR("Script upload started: %s"), path);
+            break;
+        case UPLOAD_FILE_WRITE:
+            if(uploadFile && uploadFile.write(upload.buf, upload.currentSize) != upload.currentSize) {
+                __debugS(PSTR("Script upload failed, file system full?"));
+                uploadFile.close();
+                scriptUploadFailed = true;
+            }
+            break;
+        case UPLOAD_FILE_END:
+            if(uploadFile) {
+                __debugS(PSTR("Script upload finished: %u B"), uploadFile.size());
+                uploadFile.close();
+            }
+            break;
+        case UPLOAD_FILE_ABORTED:
+            if(uploadFile)
+                uploadFile.close();
+            scriptUploadFailed = true;
+            break;
+    }
+}
+
 void handleFileUpload() {
     HTTPUpload& upload = webServer.upload();
 
@@ -248,35 +474,96 @@ void initWebserver() {
 
     webServer.on("/info", HTTP_GET, []() {
         // __debugS(PSTR("/info requested; URI: %s"),webServer.uri().c_str());
-        char info[60];
-        String response, smuffVersion = "No SMuFF attached.";
-        __debugS(PSTR("Pinging SMuFF..."));
-        isPinging = true;
-        SerialSmuff.write("M155S0\n");
-        delay(250);
-        if(SerialSmuff.available()) {
-            serialSmuffEvent();
-            bufFromSMuFF.clear();
-            SerialSmuff.write("M115\n");
-            delay(250);
-            if(SerialSmuff.available()) {
-                serialSmuffEvent();
-                getStringFromBuffer(response);
-                isPinging = false;
-                if(response.length() > 0) {
-                    __debugS(PSTR("SMuFF responded with: %s"), response.c_str());
-                    int pos1 =  response.indexOf("FIRMWARE_VERSION:");
-                    if(pos1 > -1) {
-                        int pos2 = response.indexOf(" ", pos1+19);
-                        if(pos2 > -1)
-                            smuffVersion = "SMuFF "+ response.substring(pos1+18, pos2) + " attached.";
-                    }
-                    // __debugS(PSTR("%s"), smuffVersion.c_str());
-                }
+        // answered from the cache, a probe (if needed) runs in the background
+        char info[100], smuffVersion[STATUS_TEXT_LEN+20];
+        requestSmuffInfo();
+        getSmuffInfo(smuffVersion, ArraySize(smuffVersion));
+        snprintf_P(info, ArraySize(info)-1, "%s V%s\n%s", MCUTYPE, VERSION, smuffVersion);
+        sendResponse(200, MIME_TEXT, String(info));
+    });
+    webServer.on("/status", HTTP_GET, []() {
+        // served from the state cache, the serial line isn't involved
+        char json[640];
+        uint32_t now = millis();
+        StatusRecord& st = statusSMuFF.record;
+        int n = snprintf_P(json, ArraySize(json), PSTR("{\"firmware\":\"%s\",\"reports\":%lu,\"reportAge\":%ld,\"resets\":%lu,\"tool\":%d,\"spool\":%d,"),
+            statusSMuFF.firmware,
+            statusSMuFF.reports,
+            statusSMuFF.reports > 0 ? (long)(now - statusSMuFF.lastReport) : -1L,
+            statusSMuFF.resets,
+            st.tool,
+            st.spool);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR("\"selector\":%s,\"revolver\":%s,\"feeder\":%s,\"feeder2\":%s,\"sdcard\":%s,\"lid\":%s,\"idle\":%s,\"relay\":\"%s\","),
+            st.flags & ST_SELECTOR ? "true" : "false",
+            st.flags & ST_REVOLVER ? "true" : "false",
+            st.flags & ST_FEEDER ? "true" : "false",
+            st.flags & ST_FEEDER2 ? "true" : "false",
+            st.flags & ST_SDCARD ? "true" : "false",
+            st.flags & ST_LID ? "true" : "false",
+            st.flags & ST_IDLE ? "true" : "false",
+            st.flags & ST_RELAY_EXT ? "EXT" : "INT");
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR("\"dryer\":{\"temp1\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.temp1);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"temp2\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.temp2);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"hum1\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.hum1);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"hum2\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.hum2);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"heater\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.heater1);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"target\":"));
+        n += jsonTenths(json+n, ArraySize(json)-n, st.heater1Target);
+        n += snprintf_P(json+n, ArraySize(json)-n, PSTR(",\"heaterOn\":%s,\"timeout\":%u,\"fan\":%u},"),
+            st.flags & ST_HEATER_ON ? "true" : "false",
+            st.timeout,
+            st.fan1);
+        snprintf_P(json+n, ArraySize(json)-n, PSTR("\"errors\":%lu,\"lastError\":\"%s\",\"lastErrorAge\":%ld}"),
+            statusSMuFF.errors,
+            statusSMuFF.lastError,
+            statusSMuFF.errors > 0 ? (long)(now - statusSMuFF.lastErrorTime) : -1L);
+        sendResponse(200, MIME_JSON, String(json));
+    });
+    webServer.on("/metrics", HTTP_GET, sendMetrics);
+    webServer.on("/latency", HTTP_GET, []() {
+        char json[640];
+        getLatencyJson(json, ArraySize(json));
+        sendResponse(200, MIME_JSON, String(json));
+    });
+    webServer.on("/capture", HTTP_GET, []() {
+        // see "Capture format" in wi-control.md
+        uint8_t chunk[512];
+        webServer.sendHeader(PSTR("Content-Disposition"), PSTR("attachment; filename=capture.bin"));
+        if(captureToFile) {
+            stopCapture();
+            File file = LittleFS.open(CAPTURE_FILE, "r");
+            if(!file) {
+                sendResponse(404, MIME_TEXT, String("No capture file"));
+                return;
             }
+            webServer.setContentLength(file.size());
+            sendResponse(200, MIME_BINARY, String());
+            size_t len;
+            while((len = file.read(chunk, ArraySize(chunk))) > 0)
+                webServer.sendContent((const char*)chunk, len);
+            file.close();
+            return;
         }
-        snprintf_P(info, ArraySize(info)-1, "%s V%s\n%s", MCUTYPE, VERSION, smuffVersion.c_str());
-        sendResponse(200, MIME_TEXT, String(info));
+        // records must not be overwritten while they're being sent
+        bool wasOn;
+        size_t total = pauseCapture(wasOn);
+        CaptureHeader hdr = { { 'S', 'M', 'C', 'P' }, CAPTURE_VERSION, 0 };
+        webServer.setContentLength(sizeof(hdr) + total);
+        sendResponse(200, MIME_BINARY, String());
+        webServer.sendContent((const char*)&hdr, sizeof(hdr));
+        for(size_t ofs = 0; ofs < total; ) {
+            size_t len = readCapture(ofs, chunk, ArraySize(chunk));
+            if(len == 0)
+                break;
+            webServer.sendContent((const char*)chunk, len);
+            ofs += len;
+        }
+        resumeCapture(wasOn);
     });
     webServer.on("/debug", HTTP_GET, []() {
         // __debugS(PSTR("/debug requested; URI: %s"),webServer.uri().c_str());
@@ -295,6 +582,7 @@ void initWebserver() {
             wifiMgr.resetSettings();                // wipe credentials
         }
         if(value == "me") {
+            flushLog();
             ESP.restart();
         }
     });
@@ -324,11 +612,19 @@ void initWebserver() {
                 webSocketServer.close();
                 webServer.client().stop();
                 delay(100);
+                flushLog();
                 ESP.restart();
             }
         }
     }, handleFileUpload); 
 
+    webServer.on("/uploadScript", HTTP_POST, []() {
+        if(scriptUploadFailed)
+            sendResponse(500, MIME_TEXT, String("Script couldn't be stored"));
+        else
+            sendOkResponse();
+    }, handleScriptUpload);
+
     #if defined(USE_FS)
         webServer.serveStatic("/", LittleFS, "/");
     #endif
@@ -371,11 +667,16 @@ void hexDump(const void *mem, uint32_t len, uint8_t cols = 16) {
 
 void wsEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
 
-    curClient = (int)num;
     switch(type) {
         case WStype_DISCONNECTED:
             __debugS(PSTR("%s%u has disconnected!"), wsCliPrefix, num);
-            curClient = -1;
+            wsClients[num].connected = false;
+            wsClients[num].binary = false;
+            wsClients[num].uart = false;
+            if(wsClients[num].queue != nullptr) {
+                delete wsClients[num].queue;
+                wsClients[num].queue = nullptr;
+            }
             wsClientsConnected--;
             if(wsClientsConnected < 0)
                 wsClientsConnected = 0;
@@ -384,12 +685,25 @@ void wsEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
             {
                 IPAddress ip = webSocketServer.remoteIP(num);
                 __debugS(PSTR("%s%u has connected from %d.%d.%d.%d url: %s"), wsCliPrefix, num, ip[0], ip[1], ip[2], ip[3], payload);
+                WsClient& client = wsClients[num];
+                if(client.queue == nullptr)
+                    client.queue = new WsQueue();
+                client.connected = true;
+                client.binary = false;
+                client.uart = false;
+                client.summary = false;
+                client.behindSince = 0;
+                client.backoffUntil = millis();
+                client.queued = client.dropped = client.slowWrites = 0;
+                client.queuePeak = 0;
                 wsClientsConnected++;
             }
             break;
         case WStype_TEXT: {
                 String cmd = String((const char*)payload);
                 __debugS(PSTR("%s%u sent: %s"), wsCliPrefix, num, cmd.c_str());
+                // responses go back to this client only
+                replyClient = num;
                 if(cmd.startsWith(cmdWI)) {
                     if(cmd.length() > 7)
                         handleControlMessage(cmd.substring(7));
@@ -397,9 +711,9 @@ void wsEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
                         __debugS("Malformed WI-CMD!");
                 }
                 else {
-                    SerialSmuff.write(cmd.c_str());
-                    wiSent++;
+                    queueCommands(cmd.c_str(), cmd.length(), num);
                 }
+                replyClient = WS_BROADCAST;
             }
             break;
         case WStype_BIN:
@@ -427,25 +741,295 @@ void wsEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
 void initWebsockets() {
     webSocketServer.begin();
     webSocketServer.onEvent(wsEvent);
+    webSocketServer.enableHeartbeat(WS_PING_MS, WS_PONG_MS, WS_PONG_MISSES);
     __debugS(PSTR("WebSocketsServer running"));
 }
 
 void sendToWebsocket(String& data) {
+    sendToWebsocket(data.c_str(), data.length());
+}
+
+void writeFrame(uint8_t num, uint8_t* frame, size_t len, bool binary) {
+    WsClient& client = wsClients[num];
+    uint32_t start = millis();
+    if(binary)
+        webSocketServer.sendBIN(num, frame, len, true);
+    else
+        webSocketServer.sendTXT(num, frame, len, true);
+    wsFrames++;
+    wsBytes += len;
+    if(millis() - start > WS_SLOW_WRITE) {
+        client.slowWrites++;
+        client.backoffUntil = millis() + WS_BACKOFF_MS;
+    }
+}
+
+bool canWrite(uint8_t num, size_t len) {
+    WsClient& client = wsClients[num];
+    return (int32_t)(millis() - client.backoffUntil) >= 0 &&
+           webSocketServer.canWrite(num, len + WEBSOCKETS_MAX_HEADER_SIZE);
+}
+
+/*
+ * Writes the frame right away if the client is able to take it, otherwise
+ * it gets queued for that client (as length, type and payload).
+ */
+void sendToClient(uint8_t num, uint8_t* frame, size_t len, bool binary) {
+    WsClient& client = wsClients[num];
+    if(client.queue == nullptr)
+        return;
+    if(client.queue->isEmpty() && canWrite(num, len)) {
+        writeFrame(num, frame, len, binary);
+        return;
+    }
+    if(client.queue->free() < len + 3) {
+        client.dropped++;
+        if(!client.summary) {
+            __debugS(PSTR("%s%u can't keep up, sending summary only"), wsCliPrefix, num);
+            client.summary = true;
+            wsDowngrades++;
+        }
+        return;
+    }
+    uint8_t hdr[3] = { (uint8_t)(len & 0xFF), (uint8_t)(len >> 8), binary };
+    client.queue->push(hdr, 3);
+    client.queue->push(frame + WEBSOCKETS_MAX_HEADER_SIZE, len);
+    client.queued++;
+    if(client.queue->size() > client.queuePeak)
+        client.queuePeak = client.queue->size();
+    if(client.behindSince == 0)
+        client.behindSince = millis() | 1;
+}
+
+/*
+ * Sends the frame to the target client or to all of them. The payload
+ * starts after WEBSOCKETS_MAX_HEADER_SIZE bytes reserved for the header.
+ * Clients in summary mode only get status reports and replies.
+ */
+void sendFrame(int target, uint8_t* frame, size_t len, bool binary = false, bool status = false) {
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(!wsClients[i].connected || (target != WS_BROADCAST && target != i))
+            continue;
+        if(target == WS_BROADCAST && wsClients[i].summary && !status)
+            continue;
+        sendToClient(i, frame, len, binary);
+    }
+}
+
+/*
+ * Writes the frames queued for the clients, as far as they can take them,
+ * and drops the ones which have been behind for too long.
+ */
+void drainClients() {
+    static uint8_t frame[WEBSOCKETS_MAX_HEADER_SIZE + WS_BATCH_SIZE];      // larger frames don't get queued
+    uint32_t now = millis();
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        WsClient& client = wsClients[i];
+        if(!client.connected || client.queue == nullptr)
+            continue;
+        while(!client.queue->isEmpty()) {
+            size_t len = (*client.queue)[0] | ((*client.queue)[1] << 8);
+            bool binary = (*client.queue)[2] != 0;
+            if(!canWrite(i, len))
+                break;
+            client.queue->commit(3);
+            client.queue->pop(&frame[WEBSOCKETS_MAX_HEADER_SIZE], len);
+            writeFrame(i, frame, len, binary);
+        }
+        if(client.queue->isEmpty()) {
+            if(client.summary && client.behindSince != 0)
+                __debugS(PSTR("%s%u has caught up"), wsCliPrefix, i);
+            client.behindSince = 0;
+            client.summary = false;
+            continue;
+        }
+        if(now - client.behindSince > WS_EVICT_MS) {
+            __debugS(PSTR("%s%u is too slow, disconnecting"), wsCliPrefix, i);
+            wsEvictions++;
+            webSocketServer.disconnect(i);
+        }
+        else if(now - client.behindSince > WS_SUMMARY_MS && !client.summary) {
+            __debugS(PSTR("%s%u is behind, sending summary only"), wsCliPrefix, i);
+            client.summary = true;
+            wsDowngrades++;
+        }
+    }
+}
+
+int getWebsocketClientStats(char* buf, size_t len) {
+    int n = snprintf_P(buf, len, PSTR("WS clients:\t%d, %lu downgraded, %lu evicted\n"), wsClientsConnected, wsDowngrades, wsEvictions);
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX && n < (int)len; i++) {
+        WsClient& client = wsClients[i];
+        if(!client.connected || client.queue == nullptr)
+            continue;
+        n += snprintf_P(buf+n, len-n, PSTR("WS client %u:\t%u/%u B queued (max. %u), %lu frames queued, %lu dropped, %lu slow writes%s%s\n"),
+            i,
+            client.queue->size(),
+            client.queue->capacity(),
+            client.queuePeak,
+            client.queued,
+            client.dropped,
+            client.slowWrites,
+            client.summary ? ", summary" : "",
+            client.binary ? ", binary" : "");
+    }
+    return n;
+}
+
+void flushWebsocket() {
+    if(wsBatchLen == 0)
+        return;
+    sendFrame(wsBatchTarget, wsFrame, wsBatchLen);
+    addLatency(latSend, wsBatchArrived);
+    wsBatchLen = 0;
+}
+
+bool isPrompt(const char* data, size_t len) {
+    return (len >= 2 && strncmp_P(data, PSTR("ok"), 2) == 0) ||
+           (len >= 6 && strncmp_P(data, PSTR("error:"), 6) == 0);
+}
+
+void setWebsocketBatching(uint16_t budget, uint16_t limit) {
+    flushWebsocket();
+    wsBatchBudget = budget;
+    wsBatchLimit = limit == 0 || limit > WS_BATCH_SIZE ? WS_BATCH_SIZE : limit;
+}
+
+/*
+ * Sends the data to replyClient; responses to a command go to the client
+ * which has sent it, everything else to all clients.
+ */
+void sendToWebsocket(const char* data, size_t len) {
+    if(wsClientsConnected == 0 || len == 0)
+        return;
+    wsMessages++;
+    int target = replyClient;
+    if(wsBatchLen > 0 && (target != wsBatchTarget || wsBatchLen + len > WS_BATCH_SIZE))
+        flushWebsocket();
+    if(len > WS_BATCH_SIZE) {
+        // too big to be serialized once, the library copies it for each client
+        for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+            if(wsClients[i].connected && (target == WS_BROADCAST || target == i) &&
+               (target == i || !wsClients[i].summary)) {
+                webSocketServer.sendTXT(i, (const uint8_t*)data, len);
+                wsFrames++;
+                wsBytes += len;
+            }
+        }
+        addLatency(latSend, lineArrived);
+        return;
+    }
+    if(wsBatchLen == 0) {
+        wsBatchStart = millis();
+        wsBatchArrived = lineArrived;
+        wsBatchTarget = target;
+    }
+    memcpy(wsBatch + wsBatchLen, data, len);
+    wsBatchLen += len;
+    // responses the sender is waiting for don't wait for the budget
+    if(wsBatchBudget == 0 || wsBatchLen >= wsBatchLimit || isPrompt(data, len))
+        flushWebsocket();
+}
+
+/*
+ * Status reports go to all clients, either as text or as StatusRecord.
+ */
+void sendStatusToWebsocket(const char* line, size_t len) {
+    static uint8_t record[WEBSOCKETS_MAX_HEADER_SIZE + sizeof(StatusRecord)];
     if(wsClientsConnected == 0)
         return;
-    if(curClient != -1) {
-        webSocketServer.sendTXT((uint8_t)curClient, data);
+    // keep the order of the frames
+    flushWebsocket();
+    wsMessages++;
+    memcpy(&record[WEBSOCKETS_MAX_HEADER_SIZE], &statusSMuFF.record, sizeof(StatusRecord));
+    if(len <= WS_BATCH_SIZE)
+        memcpy(wsBatch, line, len);
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(!wsClients[i].connected)
+            continue;
+        if(wsClients[i].binary) {
+            sendFrame(i, record, sizeof(StatusRecord), true, true);
+            wsBinaryRecords++;
+            if(len > sizeof(StatusRecord))
+                wsBinarySaved += len - sizeof(StatusRecord);
+        }
+        else
+            sendFrame(i, wsFrame, len, false, true);
     }
-    else {
-        __debugS(PSTR("Invalid WS Client ID!"));
+    addLatency(latSend, lineArrived);
+}
+
+/*
+ * Turns binary status records on/off for the client which asked for it
+ * (or for all clients, if the request didn't come from one).
+ */
+void setBinaryStatus(bool on) {
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(replyClient == WS_BROADCAST || replyClient == i)
+            wsClients[i].binary = on && wsClients[i].connected;
+    }
+}
+
+/*
+ * Subscribes the client which asked for it (or all clients) to the lines
+ * received on the spare UART.
+ */
+void setUartSubscription(bool on) {
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(replyClient == WS_BROADCAST || replyClient == i)
+            wsClients[i].uart = on && wsClients[i].connected;
+    }
+}
+
+int getUartSubscribers() {
+    int n = 0;
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(wsClients[i].connected && wsClients[i].uart)
+            n++;
+    }
+    return n;
+}
+
+void sendUartToWebsocket(const char* line, size_t len) {
+    static uint8_t frame[WEBSOCKETS_MAX_HEADER_SIZE + CHUNK_SIZE + 16];
+    if(wsClientsConnected == 0 || getUartSubscribers() == 0)
+        return;
+    // keep the order of the frames
+    flushWebsocket();
+    int n = snprintf_P((char*)&frame[WEBSOCKETS_MAX_HEADER_SIZE], sizeof(frame) - WEBSOCKETS_MAX_HEADER_SIZE, PSTR("echo: UART: %.*s%s"),
+        (int)len, line, len > 0 && line[len-1] == '\n' ? "" : "\n");
+    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+        if(wsClients[i].connected && wsClients[i].uart)
+            sendFrame(i, frame, n);
+    }
+}
+
+void loopBatching() {
+    uint32_t now = millis();
+    if(wsBatchLen > 0 && now - wsBatchStart >= wsBatchBudget)
+        flushWebsocket();
+    drainClients();
+    if(now - wsRateMillis >= 1000) {
+        wsMessageRate = (wsMessages - wsRateMessages) * 1000 / (now - wsRateMillis);
+        wsFrameRate = (wsFrames - wsRateFrames) * 1000 / (now - wsRateMillis);
+        wsRateMessages = wsMessages;
+        wsRateFrames = wsFrames;
+        wsRateMillis = now;
     }
 }
 
 void loopWebserver() {
-    wifiMgr.process();
     webServer.handleClient();
     webSocketServer.loop();
-    #if !defined(ESP32)
-      MDNS.update();      // ESP32 doesn't have this method
-    #endif
-}
\ No newline at end of file
+    loopBatching();
+}
+
+void loopWifiManager() {
+    wifiMgr.process();
+}
+
+#if !defined(ESP32)
+void loopMDNS() {
+    MDNS.update();      // ESP32 doesn't have this method
+}
+#endif
\ No newline at end of file
@@ -36,7 +36,7 @@ void handleDebug(String cmd);
 void handleLog(String cmd);
 void handleESP(String cmd);
 void handleSystem(String cmd);
-void sendResponse(const char* fmt, ...);
+void handleScript(String cmd);
 void sendUnknownCmdResponse(const char* cmd, const char* got);
 const char* translateParamType(ParamObject::ParamType type);
 
@@ -59,6 +59,7 @@ const char cmdDBG[] PROGMEM     = { "DBG:" };
 const char cmdLOG[] PROGMEM     = { "LOG:" };
 const char cmdESP[] PROGMEM     = { "ESP:" };
 const char cmdSYS[] PROGMEM     = { "SYS:" };
+const char cmdSCR[] PROGMEM     = { "SCR:" };
 
 const char npxMode[] PROGMEM    = { "NeoPixels mode:" };
 
@@ -77,8 +78,32 @@ const char fncINFO[] PROGMEM    = { "INFO" };
 const char fncBOOT[] PROGMEM    = { "BOOT" };
 const char fncRESET[] PROGMEM   = { "RESET" };
 const char fncSEND[] PROGMEM    = { "SEND" };
+const char fncRECEIVE[] PROGMEM = { "RECEIVE" };
 const char fncWIFI[] PROGMEM    = { "WIFI" };
 const char fncMEM[] PROGMEM     = { "MEM" };
+const char fncSTATS[] PROGMEM   = { "STATS" };
+const char fncFLOW[] PROGMEM    = { "FLOW" };
+const char fncWATER[] PROGMEM   = { "WATER" };
+const char fncXON[] PROGMEM     = { "XON" };
+const char fncRTS[] PROGMEM     = { "RTS" };
+const char fncLOSSLESS[] PROGMEM = { "LOSSLESS" };
+const char fncBAUD[] PROGMEM    = { "BAUD" };
+const char fncBATCH[] PROGMEM   = { "BATCH" };
+const char fncBINARY[] PROGMEM  = { "BINARY" };
+const char fncQUEUE[] PROGMEM   = { "QUEUE" };
+const char fncCHECKSUM[] PROGMEM = { "CHECKSUM" };
+const char fncCAPTURE[] PROGMEM = { "CAPTURE" };
+const char fncFILE[] PROGMEM    = { "FILE" };
+const char fncREPLAY[] PROGMEM  = { "REPLAY" };
+const char fncLAT[] PROGMEM     = { "LAT" };
+const char fncPROF[] PROGMEM    = { "PROF" };
+const char fncTASKS[] PROGMEM   = { "TASKS" };
+const char fncRUN[] PROGMEM     = { "RUN" };
+const char fncPAUSE[] PROGMEM   = { "PAUSE" };
+const char fncRESUME[] PROGMEM  = { "RESUME" };
+const char fncABORT[] PROGMEM   = { "ABORT" };
+const char fncSTATE[] PROGMEM   = { "STATE" };
+const char fncLIST[] PROGMEM    = { "LIST" };
 
 const char ptNone[] PROGMEM     = { "None" };
 const char ptByte[] PROGMEM     = { "Byte" };
@@ -118,6 +143,9 @@ void handleControlMessage(String msg) {
   else if(msg.startsWith(cmdSYS)) {
     handleSystem(String(msg.substring(4)));
   }
+  else if(msg.startsWith(cmdSCR)) {
+    handleScript(String(msg.substring(4)));
+  }
   else {
     sendResponse(errUnknownCmd, msg.c_str());
   }
@@ -138,6 +166,7 @@ void sendParamWrongTypeResponse(const char* cmd, const char* param, ParamObject:
 }
 
 static char wi_resp[2048];
+const char respHeader[] PROGMEM = { "echo: WI-ESP:\n" };
 
 void sendResponse(const char* fmt, ...) {
     memset(wi_resp, 0, ArraySize(wi_resp));
@@ -147,11 +176,35 @@ void sendResponse(const char* fmt, ...) {
     va_end(arguments);
     strcat(wi_resp,"\n");
 
-    String tmp = String(PSTR("echo: WI-ESP:\n")) + String(wi_resp);
+    String tmp = String(respHeader) + String(wi_resp);
     sendToWebsocket(tmp);
     // __debugS(PSTR("%s"), tmp.c_str());
 }
 
+/*
+ * Adds what snprintf() (or a function built on it) has returned to the
+ * length n of the text in a buffer of the given size. Stops at the end of
+ * the buffer if the text got truncated, so size - n stays valid.
+ */
+int appendLen(int n, int added, size_t size) {
+    n += max(added, 0);
+    return n >= (int)size ? (int)size - 1 : n;
+}
+
+/*
+ * Sends a response which is too long for wi_resp, i.e. statistics, as it
+ * is; the text in buf has to start with respHeader.
+ */
+void sendLongResponse(char* buf, int len, size_t size) {
+    if(len > (int)strlen_P(respHeader) && buf[len-1] != '\n') {
+        // truncated, at least end the last line
+        if(len >= (int)size - 1)
+            len--;
+        buf[len++] = '\n';
+    }
+    sendToWebsocket(buf, len);
+}
+
 uint8_t getFunction(const char* cmd, char* fnc, uint8_t maxFncLen, char* params, uint8_t maxParamLen) {
     byte c;
     uint8_t ndx = 0;
@@ -273,7 +326,7 @@ uint32_t getNextParam(const char* params, ParamObject* param) {
     }
     */
 
-    uint32_t nxtIndex = strlen(pptr) == 0 ? 0 : ((uint32_t)pptr-(uint32_t)params);
+    uint32_t nxtIndex = strlen(pptr) == 0 ? 0 : (uint32_t)(pptr - params);
     // __debugS(PSTR("NextParam: ndx=%u, next=[%s] remain=%d"), nxtIndex, (pptr == nullptr ? "(null)" : pptr), strlen(pptr));
     return nxtIndex;
 }
@@ -567,6 +620,28 @@ void handleUART(String cmd) {
         data.replace("\\n", "\n");
         SerialUART.write(data.c_str());
     }
+    else if(strcmp_P(func, fncRECEIVE) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::String) {
+            sendParamWrongTypeResponse(cmdUART, fncRECEIVE, ParamObject::ParamType::String, firstParam.Type);
+            return;
+        }
+        if(strcmp_P(firstParam.Value.String, fncON) == 0)
+            setUartSubscription(true);
+        else if(strcmp_P(firstParam.Value.String, fncOFF) == 0)
+            setUartSubscription(false);
+        else {
+            sendUnknownCmdResponse(cmdUART, firstParam.Value.String);
+            return;
+        }
+        sendResponse(PSTR("Receiving from UART turned %s."), firstParam.Value.String);
+    }
+    else if(strcmp_P(func, fncSTATS) == 0) {
+        char tmp[256];
+        getUartStats(tmp, ArraySize(tmp));
+        sendResponse(PSTR("%s"), tmp);
+    }
     else {
         sendUnknownCmdResponse(cmdUART, cmd.c_str());
     }
@@ -626,21 +701,420 @@ void handleSystem(String cmd) {
             wifiMgr.getWiFiHostname().c_str(), 
             wifiMgr.getWLStatusString().c_str());
     }
+    else if(strcmp_P(func, fncSTATS) == 0) {
+        static char tmp[2688];              // static, keeps it off the (small) stack
+        // too long for sendResponse(), it goes out directly
+        int n = snprintf_P(tmp, ArraySize(tmp), respHeader);
+        unsigned long perLine = framerSMuFF.lines > 0 ? (framerSMuFF.allocsAvoided * 100) / framerSMuFF.lines : 0;
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Lines framed:\t%lu\nChunks framed:\t%lu\nBytes framed:\t%lu\nFrames copied:\t%lu\nAllocs avoided:\t%lu (%lu.%02lu per line)\n"),
+            framerSMuFF.lines,
+            framerSMuFF.chunks,
+            framerSMuFF.bytes,
+            framerSMuFF.copied,
+            framerSMuFF.allocsAvoided,
+            perLine / 100, perLine % 100), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Ring buffer:\t%u/%u B (max. %u B)\n"),
+            bufFromSMuFF.size(),
+            bufFromSMuFF.capacity(),
+            bufFromSMuFF.getHighWater()), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Link speed:\t%lu Baud\nRX throughput:\t%lu B/s (peak %lu B/s)\n"),
+            baudRate,
+            rxRate,
+            rxRatePeak), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("RX overruns:\t%lu\nRX errors:\t\t%lu\nRX dropped:\t%lu B\n"),
+            rxOverruns,
+            rxErrors,
+            rxDropped), ArraySize(tmp));
+        #if defined(ESP32)
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Bridge queue:\t%u/%d (full %lu)\n"),
+            getBridgeQueueDepth(),
+            BRIDGE_QUEUE_LEN,
+            bridgeQueueFull), ArraySize(tmp));
+        #if !defined(NOBT)
+        n = appendLen(n, getBtStats(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        #endif
+        #endif
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("WS messages:\t%lu/s, %lu B avg.\nWS frames:\t%lu/s, %lu B avg.\nWS batching:\t%u ms / %u B\n"),
+            wsMessageRate,
+            wsMessages > 0 ? wsBytes / wsMessages : 0,
+            wsFrameRate,
+            wsFrames > 0 ? wsBytes / wsFrames : 0,
+            wsBatchBudget,
+            wsBatchLimit), ArraySize(tmp));
+        n = appendLen(n, getWebsocketClientStats(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        n = appendLen(n, getTcpStats(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Status reports:\t%lu, %lu binary, %lu B saved\nInfo probes:\t%lu (%lu served from cache)\n"),
+            statusSMuFF.reports,
+            wsBinaryRecords,
+            wsBinarySaved,
+            infoProbes,
+            infoCacheHits), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Cmd queue:\t%u pending, %u/%u in flight (max. %u)\nCmds acked:\t%lu, %lu held, %lu dropped, %lu timeouts\nChecksums:\t%s, line %lu, %lu resent, %lu resends failed\n"),
+            cmdPending,
+            cmdInFlight,
+            cmdWindow,
+            cmdInFlightMax,
+            cmdAcked,
+            cmdHeld,
+            cmdDropped,
+            cmdTimeouts,
+            cmdChecksum ? fncON : fncOFF,
+            (unsigned long)cmdLine,
+            cmdResent,
+            cmdResendFailed), ArraySize(tmp));
+        n = appendLen(n, getLatencyStats(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Capture:\t%s%s, %lu records, %lu B, %lu overwritten, %lu lost\n"),
+            captureOn ? fncON : fncOFF,
+            captureToFile ? " (" CAPTURE_FILE ")" : "",
+            capRecords,
+            capBytes,
+            capOverwritten,
+            capLost), ArraySize(tmp));
+        n = appendLen(n, snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Flow control:\t%s%s\nRX overflows:\t%lu\nSMuFF paused:\t%lu times, %lu ms\n"),
+            flowControl == FLOW_XONXOFF ? fncXON : flowControl == FLOW_RTS ? fncRTS : fncOFF,
+            flowLossless ? " (lossless)" : "",
+            rxOverflows,
+            flowPauses,
+            flowPausedMs), ArraySize(tmp));
+        n = appendLen(n, getLogStats(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        sendLongResponse(tmp, n, ArraySize(tmp));
+    }
+    else if(strcmp_P(func, fncFLOW) == 0) {
+        const char* pptr = params;
+        uint32_t len = getNextParam(pptr, &firstParam);
+        FlowControl mode;
+        if(firstParam.Type != ParamObject::ParamType::String) {
+            sendParamWrongTypeResponse(cmdSYS, fncFLOW, ParamObject::ParamType::String, firstParam.Type);
+            return;
+        }
+        if(strcmp_P(firstParam.Value.String, fncOFF) == 0)
+            mode = FLOW_OFF;
+        else if(strcmp_P(firstParam.Value.String, fncXON) == 0)
+            mode = FLOW_XONXOFF;
+        else if(strcmp_P(firstParam.Value.String, fncRTS) == 0)
+            mode = FLOW_RTS;
+        else {
+            sendUnknownCmdResponse(cmdSYS, firstParam.Value.String);
+            return;
+        }
+        secondParam.Type = ParamObject::ParamType::None;
+        if(len > 0)
+            getNextParam(pptr+len, &secondParam);
+        if(!setFlowControl(mode)) {
+            sendResponse(PSTR("No RTS pin configured (see RTS_PIN in Config.h)."));
+            return;
+        }
+        flowLossless = secondParam.Type == ParamObject::ParamType::String && strcmp_P(secondParam.Value.String, fncLOSSLESS) == 0;
+        sendResponse(PSTR("Flow control set to %s%s."), firstParam.Value.String, flowLossless ? " (lossless)" : "");
+    }
+    else if(strcmp_P(func, fncWATER) == 0) {
+        const char* pptr = params;
+        uint32_t len = getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::Int || len == 0) {
+            sendParamWrongTypeResponse(cmdSYS, fncWATER, ParamObject::ParamType::Int, firstParam.Type);
+            return;
+        }
+        getNextParam(pptr+len, &secondParam);
+        if(secondParam.Type != ParamObject::ParamType::Int) {
+            sendParamWrongTypeResponse(cmdSYS, fncWATER, ParamObject::ParamType::Int, secondParam.Type);
+            return;
+        }
+        if(firstParam.Value.Int <= secondParam.Value.Int || firstParam.Value.Int > BRIDGE_BUFSIZE) {
+            sendRangeErrResponse(cmdSYS, fncWATER, secondParam.Value.Int+1, BRIDGE_BUFSIZE, firstParam.Value.Int);
+            return;
+        }
+        if(secondParam.Value.Int < 0) {
+            sendRangeErrResponse(cmdSYS, fncWATER, 0, firstParam.Value.Int-1, secondParam.Value.Int);
+            return;
+        }
+        flowHighWater = (uint16_t)firstParam.Value.Int;
+        flowLowWater = (uint16_t)secondParam.Value.Int;
+        sendResponse(PSTR("Flow control watermarks set to %d / %d B."), flowHighWater, flowLowWater);
+    }
+    else if(strcmp_P(func, fncBAUD) == 0) {
+        const char* pptr = params;
+        uint32_t len = getNextParam(pptr, &firstParam);
+        if(firstParam.Type == ParamObject::ParamType::None) {
+            sendResponse(PSTR("SMuFF link running at %lu Baud."), baudRate);
+            return;
+        }
+        if(firstParam.Type != ParamObject::ParamType::Int) {
+            sendParamWrongTypeResponse(cmdSYS, fncBAUD, ParamObject::ParamType::Int, firstParam.Type);
+            return;
+        }
+        int port = SMUFF_PORT;
+        if(len > 0) {
+            getNextParam(pptr+len, &secondParam);
+            if(secondParam.Type == ParamObject::ParamType::Int)
+                port = secondParam.Value.Int;
+        }
+        if(isBaudSwitching()) {
+            sendResponse(PSTR("Baudrate negotiation already in progress."));
+        }
+        else if(!startBaudSwitch((unsigned long)firstParam.Value.Int, port)) {
+            sendResponse(PSTR("Unsupported baudrate %d. Use 115200, 230400, 460800 or 921600."), firstParam.Value.Int);
+        }
+        else {
+            sendResponse(PSTR("Switching SMuFF link to %d Baud..."), firstParam.Value.Int);
+        }
+    }
+    else if(strcmp_P(func, fncBATCH) == 0) {
+        const char* pptr = params;
+        uint32_t len = getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::Int) {
+            sendParamWrongTypeResponse(cmdSYS, fncBATCH, ParamObject::ParamType::Int, firstParam.Type);
+            return;
+        }
+        if(firstParam.Value.Int < 0 || firstParam.Value.Int > 1000) {
+            sendRangeErrResponse(cmdSYS, fncBATCH, 0, 1000, firstParam.Value.Int);
+            return;
+        }
+        int limit = 0;
+        if(len > 0) {
+            getNextParam(pptr+len, &secondParam);
+            if(secondParam.Type == ParamObject::ParamType::Int)
+                limit = secondParam.Value.Int;
+        }
+        setWebsocketBatching((uint16_t)firstParam.Value.Int, (uint16_t)limit);
+        sendResponse(PSTR("WebSocket batching set to %u ms / %u B."), wsBatchBudget, wsBatchLimit);
+    }
+    else if(strcmp_P(func, fncBINARY) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::String) {
+            sendParamWrongTypeResponse(cmdSYS, fncBINARY, ParamObject::ParamType::String, firstParam.Type);
+            return;
+        }
+        if(strcmp_P(firstParam.Value.String, fncON) == 0)
+            setBinaryStatus(true);
+        else if(strcmp_P(firstParam.Value.String, fncOFF) == 0)
+            setBinaryStatus(false);
+        else {
+            sendUnknownCmdResponse(cmdSYS, firstParam.Value.String);
+            return;
+        }
+        sendResponse(PSTR("Binary status records turned %s (%u bytes each)."), firstParam.Value.String, sizeof(StatusRecord));
+    }
+    else if(strcmp_P(func, fncCHECKSUM) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::String) {
+            sendParamWrongTypeResponse(cmdSYS, fncCHECKSUM, ParamObject::ParamType::String, firstParam.Type);
+            return;
+        }
+        bool on;
+        if(strcmp_P(firstParam.Value.String, fncON) == 0)
+            on = true;
+        else if(strcmp_P(firstParam.Value.String, fncOFF) == 0)
+            on = false;
+        else {
+            sendUnknownCmdResponse(cmdSYS, firstParam.Value.String);
+            return;
+        }
+        if(!setChecksum(on)) {
+            sendResponse(PSTR("Checksums need the command queue (SYS:QUEUE > 0)."));
+            return;
+        }
+        sendResponse(PSTR("Line numbers and checksums turned %s."), firstParam.Value.String);
+    }
+    else if(strcmp_P(func, fncCAPTURE) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::String) {
+            sendParamWrongTypeResponse(cmdSYS, fncCAPTURE, ParamObject::ParamType::String, firstParam.Type);
+            return;
+        }
+        if(strcmp_P(firstParam.Value.String, fncON) == 0 || strcmp_P(firstParam.Value.String, fncFILE) == 0) {
+            if(!startCapture(strcmp_P(firstParam.Value.String, fncFILE) == 0)) {
+                sendResponse(PSTR("Capture can't be started (already running or out of memory)."));
+                return;
+            }
+            sendResponse(PSTR("Capture started, download it from /capture."));
+        }
+        else if(strcmp_P(firstParam.Value.String, fncOFF) == 0) {
+            stopCapture();
+            sendResponse(PSTR("Capture stopped: %lu records, %lu B."), capRecords, capBytes);
+        }
+        else if(strcmp_P(firstParam.Value.String, fncCLEAR) == 0) {
+            clearCapture();
+            sendResponse(PSTR("Capture cleared."));
+        }
+        else
+            sendUnknownCmdResponse(cmdSYS, firstParam.Value.String);
+    }
+    else if(strcmp_P(func, fncLAT) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type == ParamObject::ParamType::String) {
+            if(strcmp_P(firstParam.Value.String, fncRESET) == 0)
+                resetLatency();
+            else if(strcmp_P(firstParam.Value.String, fncON) == 0 || strcmp_P(firstParam.Value.String, fncOFF) == 0)
+                latStamps = strcmp_P(firstParam.Value.String, fncON) == 0;
+            else {
+                sendUnknownCmdResponse(cmdSYS, firstParam.Value.String);
+                return;
+            }
+        }
+        char tmp[256];
+        int n = getLatencyStats(tmp, ArraySize(tmp));
+        snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("Timestamps:\t%s"), latStamps ? fncON : fncOFF);
+        sendResponse(PSTR("%s"), tmp);
+    }
+    else if(strcmp_P(func, fncTASKS) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type == ParamObject::ParamType::String && strcmp_P(firstParam.Value.String, fncRESET) == 0) {
+            scheduler.reset();
+            sendResponse(PSTR("Task statistics reset."));
+            return;
+        }
+        // too long for sendResponse(), it goes out directly
+        static char tmp[sizeof(respHeader) + SCHED_MAX_TASKS * SCHED_LINE_LEN];
+        int n = snprintf_P(tmp, ArraySize(tmp), respHeader);
+        n = appendLen(n, scheduler.print(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        sendLongResponse(tmp, n, ArraySize(tmp));
+    }
+    else if(strcmp_P(func, fncPROF) == 0) {
+        #if defined(LOOP_PROFILER)
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type == ParamObject::ParamType::String && strcmp_P(firstParam.Value.String, fncRESET) == 0) {
+            loopProfiler.reset();
+            sendResponse(PSTR("Profiler reset."));
+            return;
+        }
+        // too long for sendResponse(), it goes out directly
+        static char tmp[sizeof(respHeader) + PROF_STAGES * PROF_LINE_LEN];
+        int n = snprintf_P(tmp, ArraySize(tmp), respHeader);
+        n = appendLen(n, loopProfiler.print(tmp+n, ArraySize(tmp)-n), ArraySize(tmp));
+        sendLongResponse(tmp, n, ArraySize(tmp));
+        #else
+        sendResponse(PSTR("Profiler not compiled in (see LOOP_PROFILER in Config.h)."));
+        #endif
+    }
+    else if(strcmp_P(func, fncREPLAY) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type == ParamObject::ParamType::String && strcmp_P(firstParam.Value.String, fncOFF) == 0) {
+            stopReplay();
+            return;
+        }
+        if(firstParam.Type == ParamObject::ParamType::String && strcmp_P(firstParam.Value.String, fncSTATE) == 0) {
+            char tmp[200];
+            getReplayState(tmp, ArraySize(tmp));
+            sendResponse(PSTR("%s"), tmp);
+            return;
+        }
+        if(firstParam.Type != ParamObject::ParamType::Int) {
+            sendParamWrongTypeResponse(cmdSYS, fncREPLAY, ParamObject::ParamType::Int, firstParam.Type);
+            return;
+        }
+        if(firstParam.Value.Int < 0 || firstParam.Value.Int > 1000) {
+            sendRangeErrResponse(cmdSYS, fncREPLAY, 0, 1000, firstParam.Value.Int);
+            return;
+        }
+        if(!startReplay((uint16_t)firstParam.Value.Int)) {
+            sendResponse(PSTR("No capture to replay in " CAPTURE_FILE " (or still recording)."));
+            return;
+        }
+        sendResponse(PSTR("Replaying " CAPTURE_FILE "."));
+    }
+    else if(strcmp_P(func, fncQUEUE) == 0) {
+        const char* pptr = params;
+        getNextParam(pptr, &firstParam);
+        if(firstParam.Type != ParamObject::ParamType::Int) {
+            sendParamWrongTypeResponse(cmdSYS, fncQUEUE, ParamObject::ParamType::Int, firstParam.Type);
+            return;
+        }
+        if(firstParam.Value.Int < 0 || firstParam.Value.Int > CMDQ_MAX_WINDOW) {
+            sendRangeErrResponse(cmdSYS, fncQUEUE, 0, CMDQ_MAX_WINDOW, firstParam.Value.Int);
+            return;
+        }
+        if(firstParam.Value.Int == 0 && isScriptRunning()) {
+            // scripts are paced by the window
+            sendResponse(PSTR("Can't turn off the command queue while a script is running."));
+            return;
+        }
+        setCommandWindow((uint8_t)firstParam.Value.Int);
+        sendResponse(PSTR("Command window set to %u."), cmdWindow);
+    }
     else {
         sendUnknownCmdResponse(cmdSYS, cmd.c_str());
     }
 }
 
+void handleScript(String cmd) {
+    char func[30];
+    char params[60];
+    uint8_t paramCnt = getFunction(cmd.c_str(), func, ArraySize(func)-1, params, ArraySize(params)-1);
+
+    if(strcmp_P(func, fncRUN) == 0) {
+        if(paramCnt == 0) {
+            sendParamWrongTypeResponse(cmdSCR, fncRUN, ParamObject::ParamType::String, ParamObject::ParamType::None);
+            return;
+        }
+        if(cmdWindow == 0) {
+            sendResponse(PSTR("Scripts need the command queue (SYS:QUEUE > 0)."));
+            return;
+        }
+        if(!runScript(params)) {
+            sendResponse(PSTR("Can't run script '%s'."), params);
+            return;
+        }
+        sendResponse(PSTR("Script %s started."), params);
+    }
+    else if(strcmp_P(func, fncPAUSE) == 0) {
+        if(!pauseScript(true))
+            sendResponse(PSTR("No script running."));
+    }
+    else if(strcmp_P(func, fncRESUME) == 0) {
+        if(!pauseScript(false))
+            sendResponse(PSTR("No script paused."));
+    }
+    else if(strcmp_P(func, fncABORT) == 0) {
+        if(!abortScript())
+            sendResponse(PSTR("No script running."));
+    }
+    else if(strcmp_P(func, fncSTATE) == 0) {
+        char tmp[120];
+        getScriptState(tmp, ArraySize(tmp));
+        sendResponse(PSTR("%s"), tmp);
+    }
+    else if(strcmp_P(func, fncLIST) == 0) {
+        char tmp[512];
+        int n = snprintf_P(tmp, ArraySize(tmp), PSTR("Scripts:\n"));
+        #if defined(ESP32)
+        File dir = LittleFS.open(SCRIPT_DIR);
+        File file;
+        while(dir && (file = dir.openNextFile()) && n < (int)ArraySize(tmp)) {
+            n += snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("%s\t%u B\n"), file.name(), file.size());
+            file.close();
+        }
+        #else
+        Dir dir = LittleFS.openDir(SCRIPT_DIR);
+        while(dir.next() && n < (int)ArraySize(tmp)) {
+            n += snprintf_P(tmp+n, ArraySize(tmp)-n, PSTR("%s\t%u B\n"), dir.fileName().c_str(), dir.fileSize());
+        }
+        #endif
+        sendResponse(PSTR("%s"), tmp);
+    }
+    else {
+        sendUnknownCmdResponse(cmdSCR, cmd.c_str());
+    }
+}
+
 void handleESP(String cmd) {
     char func[30];
     char params[60];
     uint8_t paramCnt = getFunction(cmd.c_str(), func, ArraySize(func)-1, params, ArraySize(params)-1);
 
     if(strcmp_P(func, fncBOOT) == 0) {
+        flushLog();
         ESP.restart();
     }
 #if !defined(ESP32)
     else if(strcmp_P(func, fncRESET) == 0) {
+        flushLog();
         ESP.reset();
     }
 #endif
@@ -0,0 +1,212 @@
+/*
+ * Host benchmark and sanity check for SpscRing (include/SpscRing.h).
+ *
+ * Compares the throughput of SpscRing's bulk push()/pop() with the per byte
+ * lockedPush()/lockedPop() of the Locoduino RingBuf it replaced, then checks
+ * that data survives the wraparound of the ring and that a consumer thread
+ * sees exactly what a producer thread has pushed (acquire/release order).
+ *
+ *   g++ -std=gnu++17 -O2 -pthread -Itest/shim -Iinclude \
+ *       test/bench_ring/bench_ring.cpp test/shim/shim.cpp -o bench_ring && ./bench_ring
+ *
+ * Exits with 1 if a check fails.
+ */
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+#include "SpscRing.h"
+
+#define RING_SIZE       2048        // BRIDGE_BUFSIZE
+#define CHUNK           64          // bytes per push/pop, about a line
+#define BENCH_BYTES     (64UL * 1024 * 1024)
+#define THREAD_BYTES    (16UL * 1024 * 1024)
+
+/*
+ * The relevant part of Locoduino's RingBuf, as it was used for bufFromSMuFF.
+ * On the host, noInterrupts()/interrupts() are only compiler barriers, so
+ * the numbers are in favour of RingBuf.
+ */
+template<typename ET, size_t S>
+class RingBuf {
+    ET          mBuffer[S];
+    size_t      mReadIndex = 0;
+    size_t      mSize = 0;
+
+    size_t writeIndex() {
+        size_t wr = mReadIndex + mSize;
+        if(wr >= S)
+            wr -= S;
+        return wr;
+    }
+
+public:
+    bool push(const ET inElement) {
+        if(mSize == S)
+            return false;
+        mBuffer[writeIndex()] = inElement;
+        mSize++;
+        return true;
+    }
+    bool lockedPush(const ET inElement) {
+        noInterrupts();
+        bool result = push(inElement);
+        interrupts();
+        return result;
+    }
+    bool pop(ET& outElement) {
+        if(mSize == 0)
+            return false;
+        outElement = mBuffer[mReadIndex];
+        if(++mReadIndex == S)
+            mReadIndex = 0;
+        mSize--;
+        return true;
+    }
+    bool lockedPop(ET& outElement) {
+        noInterrupts();
+        bool result = pop(outElement);
+        interrupts();
+        return result;
+    }
+};
+
+static int failures = 0;
+
+static void check(bool cond, const char* what) {
+    if(!cond) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint8_t src[CHUNK], dst[CHUNK];
+static volatile uint8_t sink;
+
+static void benchRingBuf() {
+    static RingBuf<byte, RING_SIZE> ring;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned long done = 0; done < BENCH_BYTES; done += CHUNK) {
+        for(size_t n = 0; n < CHUNK; n++)
+            ring.lockedPush(src[n]);
+        for(size_t n = 0; n < CHUNK; n++)
+            ring.lockedPop(dst[n]);
+        sink = dst[CHUNK-1];
+    }
+    double secs = seconds(start);
+    printf("RingBuf lockedPush/lockedPop:\t%8.1f MB/s\n", BENCH_BYTES / secs / 1e6);
+}
+
+static void benchSpscRing() {
+    static SpscRing<byte, RING_SIZE> ring;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned long done = 0; done < BENCH_BYTES; done += CHUNK) {
+        ring.push(src, CHUNK);
+        ring.pop(dst, CHUNK);
+        sink = dst[CHUNK-1];
+    }
+    double secs = seconds(start);
+    printf("SpscRing push/pop (%u B):\t%8.1f MB/s\n", CHUNK, BENCH_BYTES / secs / 1e6);
+}
+
+/*
+ * Odd sized pushes and pops, so the data wraps around the end of the ring
+ * at every possible offset; also checks size(), free() and the spans.
+ */
+static void testWraparound() {
+    static SpscRing<byte, 64> ring;
+    uint8_t in[64], out[64];
+    uint8_t next = 0, expect = 0;
+    bool ok = true;
+    for(int round = 0; round < 1000 && ok; round++) {
+        size_t len = 1 + (round * 7) % 63;
+        for(size_t n = 0; n < len; n++)
+            in[n] = next++;
+        ok &= ring.push(in, len) == len;
+        ok &= ring.size() == len && ring.free() == 64 - len;
+        ok &= ring.push(in, 64) == 64 - len;            // only fills up to the capacity
+        ok &= ring.isFull() && ring.writable().len == 0;
+        size_t part = ring.peek().len;
+        ok &= part > 0 && part <= 64;
+        ok &= ring.pop(out, len) == len;
+        for(size_t n = 0; n < len; n++)
+            ok &= out[n] == expect++;
+        ring.clear();
+        ok &= ring.isEmpty() && ring.pop(out, 1) == 0;
+    }
+    check(ok, "wraparound");
+    check(ring.getHighWater() == 64, "high water mark");
+}
+
+/*
+ * Producer and consumer on different threads, moving a counting sequence
+ * in random sized blocks, partly through writable()/produce() and
+ * peek()/commit(). Any reordering of the data and index accesses shows up
+ * as a wrong byte.
+ */
+static void testThreads() {
+    static SpscRing<byte, RING_SIZE> ring;
+    std::atomic<bool> ok { true };
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        uint8_t seq = 0;
+        uint32_t rnd = 1;
+        for(unsigned long done = 0; done < THREAD_BYTES; ) {
+            rnd = rnd * 1103515245 + 12345;
+            size_t len = 1 + (rnd >> 16) % 300;
+            if(rnd & 0x100) {
+                SpscRing<byte, RING_SIZE>::Span span = ring.writable();
+                if(span.len == 0)
+                    yield();
+                len = min(len, span.len);
+                for(size_t n = 0; n < len; n++)
+                    span.data[n] = seq++;
+                ring.produce(len);
+            }
+            else {
+                uint8_t buf[300];
+                for(size_t n = 0; n < len; n++)
+                    buf[n] = seq + n;
+                len = ring.push(buf, len);
+                if(len == 0)
+                    yield();
+                seq += len;
+            }
+            done += len;
+        }
+    });
+    std::thread consumer([&]() {
+        uint8_t seq = 0;
+        for(unsigned long done = 0; done < THREAD_BYTES; ) {
+            SpscRing<byte, RING_SIZE>::Span span = ring.peek();
+            if(span.len == 0)
+                yield();
+            for(size_t n = 0; n < span.len; n++) {
+                if(span.data[n] != seq++)
+                    ok = false;
+            }
+            ring.commit(span.len);
+            done += span.len;
+        }
+    });
+    producer.join();
+    consumer.join();
+    double secs = seconds(start);
+    printf("SpscRing 2 threads:\t\t%8.1f MB/s\n", THREAD_BYTES / secs / 1e6);
+    check(ok, "producer/consumer threads");
+    check(ring.isEmpty(), "empty after threads");
+}
+
+int main() {
+    for(size_t n = 0; n < CHUNK; n++)
+        src[n] = (uint8_t)n;
+    benchRingBuf();
+    benchSpscRing();
+    testWraparound();
+    testThreads();
+    printf("%s\n", failures == 0 ? "All checks passed" : "Checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
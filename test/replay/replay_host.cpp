@@ -0,0 +1,242 @@
+/*
+ * Host replay of a capture file (see capture.cpp) through the firmware.
+ *
+ * The firmware is built for the host against test/shim (ESP8266 flavour).
+ * setup() runs as on the ESP, then the data the SMuFF has sent is fed to
+ * SerialSmuff while loop() runs, so the UART reader, the ring buffer, the
+ * line framing (dumpBuffer), WI-CMD handling (handleControlMessage) and the
+ * WebSocket output path all see the recorded traffic. At the end it reports
+ * lines/s, the heap allocations per line and the peak heap usage.
+ *
+ *   replay_host [options] capture.bin
+ *     -s <factor>  recorded pace times factor; 0 (default) as fast as the
+ *                  UART buffer takes the data
+ *     -c <n>       WebSocket clients connected (default 1)
+ *     -w <bytes>   free send buffer of the clients (default 5744), smaller
+ *                  values make them slow
+ *     -x <cmd>     WI-CMD run before the replay, e.g. -x "SYS:BATCH:5 1024"
+ *                  (can be repeated)
+ *     -t           send the recorded commands to the SMuFF as WebSocket
+ *                  client 0 would, through the command queue
+ *     -o           copy the WebSocket output to stdout
+ *     -d           copy the debug/log output to stderr
+ *
+ * See test/README.md for building it.
+ */
+#include "Config.h"
+#include <WebSocketsServer.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <vector>
+
+extern void setup();
+extern void loop();
+
+/*
+ * Every allocation on the host goes through malloc(), including the ones
+ * of operator new, String and the firmware's own malloc() calls.
+ */
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+static unsigned long heapAllocs = 0;
+static size_t heapUsed = 0, heapPeak = 0;
+
+static void trackAlloc(void* ptr) {
+    if(ptr == nullptr)
+        return;
+    heapAllocs++;
+    heapUsed += malloc_usable_size(ptr);
+    if(heapUsed > heapPeak)
+        heapPeak = heapUsed;
+}
+
+static void trackFree(void* ptr) {
+    if(ptr != nullptr)
+        heapUsed -= malloc_usable_size(ptr);
+}
+
+extern "C" void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    trackAlloc(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t num, size_t size) {
+    void* ptr = __libc_calloc(num, size);
+    trackAlloc(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    trackFree(ptr);
+    ptr = __libc_realloc(ptr, size);
+    trackAlloc(ptr);
+    return ptr;
+}
+
+extern "C" void free(void* ptr) {
+    trackFree(ptr);
+    __libc_free(ptr);
+}
+
+typedef struct {
+    CaptureRecord   rec;
+    size_t          offset;         // of the data in replayData
+} ReplayRecord;
+
+static std::vector<ReplayRecord> replayRecords;
+static std::vector<uint8_t> replayData;
+
+static bool loadCapture(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr) {
+        perror(path);
+        return false;
+    }
+    CaptureHeader hdr;
+    if(fread(&hdr, sizeof(hdr), 1, file) != 1 || strncmp(hdr.magic, "SMCP", 4) != 0 || hdr.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a capture file (version %d)\n", path, CAPTURE_VERSION);
+        fclose(file);
+        return false;
+    }
+    ReplayRecord rr;
+    while(fread(&rr.rec, sizeof(rr.rec), 1, file) == 1) {
+        rr.offset = replayData.size();
+        replayData.resize(rr.offset + rr.rec.len);
+        if(fread(replayData.data() + rr.offset, 1, rr.rec.len, file) != rr.rec.len) {
+            fprintf(stderr, "%s: truncated record at %zu\n", path, replayRecords.size());
+            replayData.resize(rr.offset);
+            break;
+        }
+        replayRecords.push_back(rr);
+    }
+    fclose(file);
+    return true;
+}
+
+/*
+ * Feeds the data to the UART. As fast as possible, it only gets as much as
+ * fits into the RX buffer; at the recorded pace, what doesn't fit is lost,
+ * like on the ESP.
+ */
+static void feedSmuff(const uint8_t* data, size_t len, bool paced) {
+    while(len > 0) {
+        size_t n = paced ? len : min(len, SerialSmuff.hostRxFree());
+        n = SerialSmuff.hostReceive(data, n);
+        data += n;
+        len -= paced ? len : n;
+        loop();
+    }
+}
+
+static void sendCommand(const uint8_t* data, size_t len) {
+    static char cmd[UINT16_MAX + 1];
+    memcpy(cmd, data, len);
+    cmd[len] = 0;
+    WebSocketsServerCore::hostServer->hostEvent(0, WStype_TEXT, cmd);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-s factor] [-c clients] [-w bytes] [-x WI-CMD]... [-t] [-o] [-d] capture.bin\n", name);
+}
+
+int main(int argc, char** argv) {
+    unsigned speed = 0;
+    int clients = 1, writeSpace = -1;
+    bool sendCommands = false, echoWS = false, echoLog = false;
+    std::vector<const char*> controls;
+    int opt;
+    while((opt = getopt(argc, argv, "s:c:w:x:tod")) != -1) {
+        switch(opt) {
+            case 's': speed = atoi(optarg); break;
+            case 'c': clients = constrain(atoi(optarg), 0, WEBSOCKETS_SERVER_CLIENT_MAX); break;
+            case 'w': writeSpace = atoi(optarg); break;
+            case 'x': controls.push_back(optarg); break;
+            case 't': sendCommands = true; break;
+            case 'o': echoWS = true; break;
+            case 'd': echoLog = true; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if(!loadCapture(argv[optind]))
+        return 1;
+
+    if(echoLog)
+        SerialUART.hostEcho = stderr;
+    size_t heapBefore = heapUsed;
+    setup();
+    WebSocketsServerCore* ws = WebSocketsServerCore::hostServer;
+    if(echoWS)
+        ws->hostEcho = stdout;
+    for(int i = 0; i < clients; i++) {
+        if(writeSpace >= 0)
+            ws->hostSetWriteSpace(i, writeSpace);
+        ws->hostEvent(i, WStype_CONNECTED, "/");
+    }
+    for(const char* ctl : controls) {
+        String msg(ctl);
+        msg += '\n';                   // as the WebSocket clients send it
+        handleControlMessage(msg);
+    }
+    size_t heapSetup = heapUsed - heapBefore;
+    loop();
+
+    unsigned long linesStart = framerSMuFF.lines, sentStart = smuffSent;
+    unsigned long allocsStart = heapAllocs;
+    unsigned long framesStart = ws->hostFrames, bytesStart = ws->hostBytes;
+    unsigned long rxBytesStart = rxBytes;
+    size_t heapStart = heapPeak = heapUsed;
+    unsigned long start = micros();
+    uint32_t first = replayRecords.empty() ? 0 : replayRecords[0].rec.micros;
+
+    for(const ReplayRecord& rr : replayRecords) {
+        if(speed > 0) {
+            while((rr.rec.micros - first) / speed > micros() - start)
+                loop();
+        }
+        const uint8_t* data = replayData.data() + rr.offset;
+        if(rr.rec.dir == CAP_RX)
+            feedSmuff(data, rr.rec.len, speed > 0);
+        else if(sendCommands)
+            sendCommand(data, rr.rec.len);
+    }
+    while(SerialSmuff.available() > 0 || !bufFromSMuFF.isEmpty())
+        loop();
+    unsigned long elapsed = micros() - start;
+    unsigned long allocs = heapAllocs - allocsStart;
+    size_t peak = heapPeak - heapStart;
+    // let the batching budget run out, so everything has been sent
+    for(unsigned long until = millis() + wsBatchBudget + 10; millis() < until; )
+        loop();
+    flushLog();
+
+    unsigned long lines = framerSMuFF.lines - linesStart;
+    double secs = elapsed / 1e6;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Replayed %s: %zu records, %lu B from the SMuFF in %.1f ms\n",
+        argv[optind], replayRecords.size(), rxBytes - rxBytesStart, elapsed / 1e3);
+    printf("Lines:\t\t%lu (%lu dispatched), %.0f lines/s, %.2f MB/s\n",
+        lines, smuffSent - sentStart, secs > 0 ? lines / secs : 0, secs > 0 ? (rxBytes - rxBytesStart) / secs / 1e6 : 0);
+    printf("Allocations:\t%lu, %.2f per line\n", allocs, lines > 0 ? (double)allocs / lines : 0);
+    printf("Heap:\t\t%zu B allocated by setup(), peak %zu B above the start of the replay\n", heapSetup, peak);
+    printf("Bridge ring:\t%u of %u B max. used, %lu overflows, %lu overruns, %lu B dropped\n",
+        (unsigned)bufFromSMuFF.getHighWater(), (unsigned)bufFromSMuFF.capacity(), rxOverflows, rxOverruns, rxDropped);
+    printf("WebSocket:\t%d clients, %lu frames, %lu B each (%lu frames, %lu B in total)\n",
+        clients, clients > 0 ? (ws->hostFrames - framesStart) / clients : 0, clients > 0 ? (ws->hostBytes - bytesStart) / clients : 0,
+        ws->hostFrames - framesStart, ws->hostBytes - bytesStart);
+    printf("Max. RSS:\t%ld kB\n", usage.ru_maxrss);
+    return 0;
+}
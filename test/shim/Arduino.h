@@ -0,0 +1,369 @@
+#pragma once
+
+/*
+ * Minimal Arduino shim for building the firmware on the host (see
+ * test/README.md). Only what the firmware actually uses is provided, in the
+ * ESP8266 flavour; everything which talks to hardware or the network is a
+ * no-op, except for the serial ports and the WebSocket server, which the
+ * host drivers feed and observe (see the host* members).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define F(s)                (s)
+#define FPSTR(s)            (s)
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+#define DEC                 10
+#define HEX                 16
+#define HIGH                1
+#define LOW                 0
+#define INPUT               0
+#define OUTPUT              1
+#define INPUT_PULLUP        2
+
+#define vsnprintf_P         vsnprintf
+#define snprintf_P          snprintf
+#define sprintf_P           sprintf
+#define strcmp_P            strcmp
+#define strncmp_P           strncmp
+#define strlen_P            strlen
+#define memcpy_P            memcpy
+#define strcpy_P            strcpy
+#define strncpy_P           strncpy
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high)   ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void esp_yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// there are no interrupts on the host; keep the compiler from moving memory accesses across
+inline void noInterrupts()  { std::atomic_signal_fence(std::memory_order_seq_cst); }
+inline void interrupts()    { std::atomic_signal_fence(std::memory_order_seq_cst); }
+
+extern volatile uint32_t __systick;
+
+inline char* strupr(char* s) {
+    for(char* p = s; *p; p++)
+        *p = toupper((unsigned char)*p);
+    return s;
+}
+inline int toUpperCase(int c)   { return toupper(c); }
+inline bool isAlpha(int c)      { return isalpha(c); }
+inline bool isDigit(int c)      { return isdigit(c); }
+
+/*
+ * Arduino's String on top of std::string. Both keep short strings in the
+ * object itself, so the allocations per line counted on the host are close
+ * to, but not exactly, the ones on the ESP.
+ */
+class String {
+    std::string s;
+
+    static std::string number(const char* fmt, ...) {
+        char tmp[40];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(tmp, sizeof(tmp), fmt, args);
+        va_end(args);
+        return tmp;
+    }
+
+public:
+    String() {}
+    String(const char* c) : s(c != nullptr ? c : "") {}
+    String(const std::string& x) : s(x) {}
+    String(const String&) = default;
+    String(String&&) = default;
+    explicit String(char c) : s(1, c) {}
+    explicit String(int v, int base = DEC) : s(number(base == HEX ? "%x" : "%d", v)) {}
+    explicit String(unsigned v, int base = DEC) : s(number(base == HEX ? "%x" : "%u", v)) {}
+    explicit String(long v, int base = DEC) : s(number(base == HEX ? "%lx" : "%ld", v)) {}
+    explicit String(unsigned long v, int base = DEC) : s(number(base == HEX ? "%lx" : "%lu", v)) {}
+    explicit String(unsigned char v, int base = DEC) : s(number(base == HEX ? "%x" : "%u", v)) {}
+    explicit String(double v, int digits = 2) : s(number("%.*f", digits, v)) {}
+    explicit String(float v, int digits = 2) : String((double)v, digits) {}
+
+    String& operator=(const String&) = default;
+    String& operator=(String&&) = default;
+    String& operator=(const char* c)            { s = c != nullptr ? c : ""; return *this; }
+
+    bool reserve(unsigned n)                    { s.reserve(n); return true; }
+    unsigned length() const                     { return s.size(); }
+    const char* c_str() const                   { return s.c_str(); }
+    char* begin()                               { return &s[0]; }
+    bool isEmpty() const                        { return s.empty(); }
+    void clear()                                { s.clear(); }
+
+    String& operator+=(const String& o)         { s += o.s; return *this; }
+    String& operator+=(const char* o)           { s += o; return *this; }
+    String& operator+=(char c)                  { s += c; return *this; }
+    String& operator+=(int v)                   { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned v)              { s += std::to_string(v); return *this; }
+    String& operator+=(long v)                  { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned long v)         { s += std::to_string(v); return *this; }
+    bool concat(const char* c, unsigned n)      { s.append(c, n); return true; }
+    bool concat(const char* c)                  { s += c; return true; }
+    bool concat(char c)                         { s += c; return true; }
+    friend String operator+(const String& a, const String& b)   { return String(a.s + b.s); }
+    friend String operator+(const String& a, const char* b)     { return String(a.s + b); }
+    friend String operator+(const char* a, const String& b)     { return String(a + b.s); }
+
+    bool operator==(const String& o) const      { return s == o.s; }
+    bool operator==(const char* o) const        { return s == o; }
+    bool operator!=(const char* o) const        { return s != o; }
+    bool equals(const char* o) const            { return s == o; }
+    char operator[](unsigned i) const           { return i < s.size() ? s[i] : 0; }
+    char& operator[](unsigned i)                { return s[i]; }
+    char charAt(unsigned i) const               { return i < s.size() ? s[i] : 0; }
+
+    String substring(unsigned from) const {
+        return from >= s.size() ? String() : String(s.substr(from));
+    }
+    String substring(unsigned from, unsigned to) const {
+        return from >= s.size() || to <= from ? String() : String(s.substr(from, to - from));
+    }
+    bool startsWith(const String& p) const      { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool startsWith(const char* p) const        { return s.compare(0, strlen(p), p) == 0; }
+    bool endsWith(const String& p) const {
+        return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0;
+    }
+    int indexOf(const char* p, unsigned from = 0) const {
+        size_t r = s.find(p, from);
+        return r == std::string::npos ? -1 : (int)r;
+    }
+    int indexOf(char c, unsigned from = 0) const {
+        size_t r = s.find(c, from);
+        return r == std::string::npos ? -1 : (int)r;
+    }
+    int indexOf(const String& p, unsigned from = 0) const { return indexOf(p.c_str(), from); }
+
+    void remove(unsigned i)                     { if(i < s.size()) s.erase(i); }
+    void remove(unsigned i, unsigned n)         { if(i < s.size()) s.erase(i, n); }
+    void replace(const char* what, const char* with) {
+        size_t wlen = strlen(what), rlen = strlen(with);
+        if(wlen == 0)
+            return;
+        for(size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + rlen))
+            s.replace(pos, wlen, with);
+    }
+    void replace(const String& what, const String& with) { replace(what.c_str(), with.c_str()); }
+    void trim() {
+        size_t first = s.find_first_not_of(" \t\r\n");
+        if(first == std::string::npos) {
+            s.clear();
+            return;
+        }
+        s = s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+    }
+    void toUpperCase() {
+        for(char& c : s)
+            c = toupper((unsigned char)c);
+    }
+    int toInt() const                           { return atoi(s.c_str()); }
+    float toFloat() const                       { return atof(s.c_str()); }
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) {
+        size_t n = 0;
+        while(n < len && write(buf[n]))
+            n++;
+        return n;
+    }
+    size_t write(const char* str)               { return write((const uint8_t*)str, strlen(str)); }
+    size_t write(const char* buf, size_t len)   { return write((const uint8_t*)buf, len); }
+    virtual int availableForWrite()             { return 0; }
+    virtual void flush() {}
+
+    size_t printf(const char* fmt, ...) {
+        char tmp[1024];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+        va_end(args);
+        return n > 0 ? write((const uint8_t*)tmp, min((size_t)n, sizeof(tmp) - 1)) : 0;
+    }
+    size_t print(const char* str)               { return write(str); }
+    size_t print(const String& str)             { return write(str.c_str(), str.length()); }
+    size_t print(char c)                        { return write((uint8_t)c); }
+    size_t print(int v, int base = DEC)         { return print(String(v, base)); }
+    size_t print(unsigned v, int base = DEC)    { return print(String(v, base)); }
+    size_t print(long v, int base = DEC)        { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(double v, int digits = 2)      { return print(String(v, digits)); }
+    size_t println()                            { return write("\r\n"); }
+    size_t println(const char* str)             { return print(str) + println(); }
+    size_t println(const String& str)           { return print(str) + println(); }
+    size_t println(int v, int base = DEC)       { return print(v, base) + println(); }
+    size_t println(unsigned long v, int base = DEC) { return print(v, base) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long) {}
+
+    // no timeouts on the host, these return what's there
+    size_t readBytes(uint8_t* buf, size_t len) {
+        size_t n = 0;
+        int c;
+        while(n < len && (c = read()) >= 0)
+            buf[n++] = (uint8_t)c;
+        return n;
+    }
+    size_t readBytes(char* buf, size_t len)     { return readBytes((uint8_t*)buf, len); }
+    size_t readBytesUntil(char term, char* buf, size_t len) {
+        size_t n = 0;
+        int c;
+        while(n < len && (c = read()) >= 0 && c != term)
+            buf[n++] = (char)c;
+        return n;
+    }
+    String readStringUntil(char term) {
+        String str;
+        int c;
+        while((c = read()) >= 0 && c != term)
+            str += (char)c;
+        return str;
+    }
+};
+
+/*
+ * Keeps what the host driver has received for it (hostReceive()) up to the
+ * size of the RX buffer, like the UART ISR does. Data written to it is
+ * counted and copied to hostEcho, if set.
+ */
+class HostSerial : public Stream {
+    std::string     rx;
+    size_t          rxPos = 0;
+    size_t          rxSize = 256;
+    bool            overrun = false;
+
+public:
+    FILE*           hostEcho = nullptr;
+    unsigned long   hostSent = 0;
+
+    size_t hostReceive(const uint8_t* data, size_t len) {
+        if(rxPos > 0 && rxPos == rx.size()) {
+            rx.clear();
+            rxPos = 0;
+        }
+        size_t room = rxSize - (rx.size() - rxPos);
+        if(len > room) {
+            overrun = true;
+            len = room;
+        }
+        rx.append((const char*)data, len);
+        return len;
+    }
+    size_t hostRxFree() const               { return rxSize - (rx.size() - rxPos); }
+
+    size_t setRxBufferSize(size_t size)     { rxSize = size; return size; }
+    size_t getRxBufferSize()                { return rxSize; }
+    bool hasOverrun()                       { bool o = overrun; overrun = false; return o; }
+    bool hasRxError()                       { return false; }
+    int available() override                { return (int)(rx.size() - rxPos); }
+    int read() override                     { return rxPos < rx.size() ? (uint8_t)rx[rxPos++] : -1; }
+    int peek() override                     { return rxPos < rx.size() ? (uint8_t)rx[rxPos] : -1; }
+    size_t read(uint8_t* buf, size_t len) {
+        len = min(len, rx.size() - rxPos);
+        memcpy(buf, rx.data() + rxPos, len);
+        rxPos += len;
+        return len;
+    }
+    size_t write(uint8_t c) override        { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t len) override {
+        hostSent += len;
+        if(hostEcho != nullptr)
+            fwrite(buf, 1, len, hostEcho);
+        return len;
+    }
+    using Print::write;
+    int availableForWrite() override        { return 4096; }
+};
+
+enum SerialConfig { SERIAL_8N1 = 0x1c };
+enum SerialMode { SERIAL_FULL, SERIAL_RX_ONLY, SERIAL_TX_ONLY };
+
+class HardwareSerial : public HostSerial {
+    unsigned long   baud = 0;
+
+public:
+    HardwareSerial(int) {}
+    void begin(unsigned long rate)          { baud = rate; }
+    void begin(unsigned long rate, SerialConfig, SerialMode = SERIAL_FULL, int = 1, bool = false) { baud = rate; }
+    void end() {}
+    void updateBaudRate(unsigned long rate) { baud = rate; }
+    unsigned long baudRate()                { return baud; }
+    void setDebugOutput(bool) {}
+    void swap() {}
+    bool isTxEnabled()                      { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+class IPAddress {
+    uint8_t     addr[4];
+
+public:
+    IPAddress() : addr { 0, 0, 0, 0 } {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr { a, b, c, d } {}
+    uint8_t operator[](int i) const         { return addr[i & 3]; }
+    String toString() const {
+        char tmp[16];
+        snprintf(tmp, sizeof(tmp), "%u.%u.%u.%u", addr[0], addr[1], addr[2], addr[3]);
+        return String(tmp);
+    }
+};
+
+// ESP8266 with an idle heap; the host drivers measure the real heap usage themselves
+struct EspClass {
+    uint32_t getFreeHeap()                  { return 40000; }
+    uint32_t getFreeContStack()             { return 3000; }
+    uint32_t getMaxFreeBlockSize()          { return 30000; }
+    uint8_t getHeapFragmentation()          { return 10; }
+    uint32_t getChipId()                    { return 0x484f5354; }
+    String getCoreVersion()                 { return String("host"); }
+    uint8_t getCpuFreqMHz()                 { return 80; }
+    String getResetReason()                 { return String("Power on"); }
+    String getResetInfo()                   { return String("Power on"); }
+    uint32_t getFreeSketchSpace()           { return 1024 * 1024; }
+    uint32_t getCycleCount()                { return micros() * getCpuFreqMHz(); }
+    void restart()                          { exit(0); }
+    void reset()                            { exit(0); }
+};
+
+extern EspClass ESP;
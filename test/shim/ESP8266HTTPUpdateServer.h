@@ -0,0 +1,9 @@
+#pragma once
+
+#include <ESP8266WebServer.h>
+
+class ESP8266HTTPUpdateServer {
+public:
+    ESP8266HTTPUpdateServer(bool = false) {}
+    void setup(ESP8266WebServer*) {}
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct NBNSClass {
+    bool begin(const char*)                 { return true; }
+};
+
+extern NBNSClass NBNS;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+#include <FS.h>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define CONTENT_LENGTH_UNKNOWN  ((size_t) -1)
+#define U_FLASH                 0
+#define U_FS                    100
+
+typedef struct {
+    HTTPUploadStatus    status;
+    String              filename;
+    String              name;
+    size_t              totalSize;
+    size_t              currentSize;
+    size_t              contentLength;
+    uint8_t             buf[2048];
+} HTTPUpload;
+
+struct UpdaterClass {
+    bool begin(size_t, int = U_FLASH, int = -1, uint8_t = LOW) { return false; }
+    size_t write(uint8_t*, size_t)          { return 0; }
+    bool end(bool = false)                  { return false; }
+    bool hasError()                         { return true; }
+    uint8_t getError()                      { return 1; }
+    String getErrorString()                 { return String("No flash on the host"); }
+    void clearError() {}
+};
+
+extern UpdaterClass Update;
+
+// no HTTP requests come in on the host
+class ESP8266WebServer {
+    HTTPUpload      uploadState {};
+    WiFiClient      noClient;
+
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    ESP8266WebServer(int) {}
+    void on(const char*, HTTPMethod, THandlerFunction) {}
+    void on(const char*, HTTPMethod, THandlerFunction, THandlerFunction) {}
+    void onNotFound(THandlerFunction) {}
+    void serveStatic(const char*, fs::FS&, const char*, const char* = nullptr) {}
+    void begin() {}
+    void handleClient() {}
+    void keepAlive(bool) {}
+    void send(int, const char* = nullptr, const String& = String()) {}
+    void send(int, const char*, const char*) {}
+    void send_P(int, const char*, const char*, size_t) {}
+    void sendHeader(const String&, const String&, bool = false) {}
+    void setContentLength(size_t) {}
+    void sendContent(const char*, size_t) {}
+    void sendContent(const char*) {}
+    void sendContent(const String&) {}
+    void sendContent_P(const char*, size_t) {}
+    String uri()                            { return String("/"); }
+    HTTPMethod method()                     { return HTTP_GET; }
+    int args()                              { return 0; }
+    String argName(int)                     { return String(); }
+    String arg(int)                         { return String(); }
+    String arg(const char*)                 { return String(); }
+    bool hasArg(const char*)                { return false; }
+    size_t clientContentLength()            { return 0; }
+    HTTPUpload& upload()                    { return uploadState; }
+    WiFiClient& client()                    { return noClient; }
+};
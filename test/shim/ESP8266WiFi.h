@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+
+enum sleep_type { NONE_SLEEP_T, LIGHT_SLEEP_T, MODEM_SLEEP_T };
+inline void wifi_set_sleep_type(sleep_type) {}
+
+/*
+ * Never connected; the WebSocket server's clients use hostWriteSpace as
+ * the free space of their send buffer.
+ */
+class WiFiClient : public Stream {
+public:
+    int             hostWriteSpace = 5744;      // 4 * TCP_MSS of lwIP's default configuration
+
+    operator bool()                         { return false; }
+    uint8_t connected()                     { return 0; }
+    void stop() {}
+    void setNoDelay(bool) {}
+    void setTimeout(unsigned long) {}
+    unsigned long getTimeout()              { return 0; }
+    int available() override                { return 0; }
+    int read() override                     { return -1; }
+    int peek() override                     { return -1; }
+    size_t read(uint8_t*, size_t)           { return 0; }
+    size_t write(uint8_t) override          { return 1; }
+    size_t write(const uint8_t*, size_t len) override { return len; }
+    using Print::write;
+    int availableForWrite() override        { return hostWriteSpace; }
+    IPAddress remoteIP()                    { return IPAddress(127, 0, 0, 1); }
+};
+
+class WiFiServer {
+public:
+    WiFiServer(uint16_t) {}
+    void begin() {}
+    void setNoDelay(bool) {}
+    bool hasClient()                        { return false; }
+    WiFiClient available()                  { return WiFiClient(); }
+    WiFiClient accept()                     { return WiFiClient(); }
+    void stop() {}
+};
+
+struct WiFiClass {
+    void macAddress(uint8_t* mac)           { memset(mac, 0, 6); }
+    IPAddress localIP()                     { return IPAddress(127, 0, 0, 1); }
+    IPAddress softAPIP()                    { return IPAddress(); }
+    bool isConnected()                      { return true; }
+    String SSID()                           { return String("host"); }
+    int32_t RSSI()                          { return -50; }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct MDNSClass {
+    bool begin(const char*)                 { return true; }
+    void addService(const char*, const char*, uint16_t) {}
+    void update() {}
+};
+
+extern MDNSClass MDNS;
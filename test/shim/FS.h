@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+
+/*
+ * A file system without files: nothing can be opened, so the firmware
+ * runs with its defaults.
+ */
+namespace fs {
+
+class File : public Stream {
+public:
+    operator bool() const                   { return false; }
+    size_t write(uint8_t) override          { return 0; }
+    size_t write(const uint8_t*, size_t) override { return 0; }
+    using Print::write;
+    int available() override                { return 0; }
+    int read() override                     { return -1; }
+    int peek() override                     { return -1; }
+    size_t read(uint8_t*, size_t)           { return 0; }
+    size_t size() const                     { return 0; }
+    size_t position() const                 { return 0; }
+    bool seek(uint32_t, SeekMode = SeekSet) { return false; }
+    void close() {}
+    const char* name() const                { return ""; }
+    bool isDirectory()                      { return false; }
+    File openNextFile()                     { return File(); }
+};
+
+class Dir {
+public:
+    bool next()                             { return false; }
+    String fileName()                       { return String(); }
+    size_t fileSize()                       { return 0; }
+};
+
+class FS {
+public:
+    bool begin()                            { return true; }
+    File open(const char*, const char* = "r") { return File(); }
+    File open(const String&, const char* = "r") { return File(); }
+    bool exists(const char*)                { return false; }
+    bool exists(const String&)              { return false; }
+    bool remove(const char*)                { return false; }
+    bool remove(const String&)              { return false; }
+    bool rename(const char*, const char*)   { return false; }
+    bool mkdir(const char*)                 { return true; }
+    Dir openDir(const char*)                { return Dir(); }
+};
+
+}
+
+using fs::File;
+using fs::FS;
+using fs::Dir;
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <FS.h>
+
+extern fs::FS LittleFS;
+extern uint32_t _FS_start, _FS_end;
+
+#define FS_start    _FS_start
+#define FS_end      _FS_end
+
+inline void close_all_fs() {}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Arduino.h>
+
+enum EspSoftwareSerialConfig { SWSERIAL_8N1 = 0 };
+
+namespace EspSoftwareSerial {
+
+class UART : public HostSerial {
+public:
+    void begin(uint32_t, EspSoftwareSerialConfig, int8_t, int8_t, bool = false, int bufCapacity = 64, int = 0) {
+        setRxBufferSize(bufCapacity);
+    }
+    bool overflow()                         { return hasOverrun(); }
+    void enableRx(bool) {}
+    void enableTx(bool) {}
+};
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#define WEBSOCKETS_SERVER_CLIENT_MAX    5
+#define WEBSOCKETS_MAX_HEADER_SIZE      14
+
+typedef enum {
+    WStype_ERROR,
+    WStype_DISCONNECTED,
+    WStype_CONNECTED,
+    WStype_TEXT,
+    WStype_BIN,
+    WStype_FRAGMENT_TEXT_START,
+    WStype_FRAGMENT_BIN_START,
+    WStype_FRAGMENT,
+    WStype_FRAGMENT_FIN,
+    WStype_PING,
+    WStype_PONG,
+} WStype_t;
+
+typedef struct {
+    uint8_t         num;
+    bool            connected;
+    WiFiClient*     tcp;
+} WSclient_t;
+
+/*
+ * Clients connect and send text when the host driver calls hostEvent().
+ * Frames sent to them are counted, and their payload is copied to hostEcho,
+ * if set. The last server created is hostServer.
+ */
+class WebSocketsServerCore {
+public:
+    typedef std::function<void(uint8_t num, WStype_t type, uint8_t* payload, size_t length)> WebSocketServerEvent;
+
+    static WebSocketsServerCore* hostServer;
+    FILE*           hostEcho = nullptr;
+    unsigned long   hostFrames = 0, hostBytes = 0;
+
+    WebSocketsServerCore() {
+        for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++)
+            _clients[i] = { i, false, &_tcp[i] };
+        hostServer = this;
+    }
+
+    void hostEvent(uint8_t num, WStype_t type, const char* payload = "") {
+        if(type == WStype_CONNECTED)
+            _clients[num].connected = true;
+        else if(type == WStype_DISCONNECTED)
+            _clients[num].connected = false;
+        if(_event)
+            _event(num, type, (uint8_t*)payload, strlen(payload));
+    }
+    // free space of the client's send buffer, see canWrite() in websvr.cpp
+    void hostSetWriteSpace(uint8_t num, int space) { _tcp[num].hostWriteSpace = space; }
+
+    void onEvent(WebSocketServerEvent event)    { _event = event; }
+    bool sendTXT(uint8_t num, uint8_t* payload, size_t length = 0, bool headerToPayload = false) {
+        return send(num, payload, length, headerToPayload);
+    }
+    bool sendTXT(uint8_t num, const uint8_t* payload, size_t length = 0) { return send(num, payload, length, false); }
+    bool sendTXT(uint8_t num, char* payload, size_t length = 0, bool headerToPayload = false) {
+        return send(num, (const uint8_t*)payload, length, headerToPayload);
+    }
+    bool sendTXT(uint8_t num, const char* payload, size_t length = 0) { return send(num, (const uint8_t*)payload, length, false); }
+    bool sendTXT(uint8_t num, String& payload)  { return send(num, (const uint8_t*)payload.c_str(), payload.length(), false); }
+    bool sendBIN(uint8_t num, uint8_t* payload, size_t length, bool headerToPayload = false) {
+        return send(num, payload, length, headerToPayload);
+    }
+    bool sendBIN(uint8_t num, const uint8_t* payload, size_t length) { return send(num, payload, length, false); }
+    void disconnect() {
+        for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++)
+            disconnect(i);
+    }
+    void disconnect(uint8_t num) {
+        if(_clients[num].connected)
+            hostEvent(num, WStype_DISCONNECTED);
+    }
+    IPAddress remoteIP(uint8_t)                 { return IPAddress(127, 0, 0, 1); }
+    bool clientIsConnected(uint8_t num)         { return _clients[num].connected; }
+    void enableHeartbeat(uint32_t, uint32_t, uint8_t) {}
+    void close()                                { disconnect(); }
+
+protected:
+    WSclient_t      _clients[WEBSOCKETS_SERVER_CLIENT_MAX];
+
+private:
+    WiFiClient      _tcp[WEBSOCKETS_SERVER_CLIENT_MAX];
+    WebSocketServerEvent _event;
+
+    bool send(uint8_t num, const uint8_t* payload, size_t length, bool headerToPayload) {
+        if(num >= WEBSOCKETS_SERVER_CLIENT_MAX || !_clients[num].connected)
+            return false;
+        if(length == 0)
+            length = strlen((const char*)payload);
+        if(headerToPayload)
+            payload += WEBSOCKETS_MAX_HEADER_SIZE;
+        hostFrames++;
+        hostBytes += length;
+        if(hostEcho != nullptr)
+            fwrite(payload, 1, length, hostEcho);
+        return true;
+    }
+};
+
+class WebSocketsServer : public WebSocketsServerCore {
+public:
+    WebSocketsServer(uint16_t, const String& = "", const String& = "arduino") {}
+    void begin() {}
+    void loop() {}
+};
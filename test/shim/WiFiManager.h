@@ -0,0 +1,15 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+class WiFiManager {
+public:
+    WiFiManager(Stream&) {}
+    void setConfigPortalBlocking(bool) {}
+    void setClass(const char*) {}
+    bool autoConnect(const char*)           { return true; }
+    void process() {}
+    void resetSettings() {}
+    String getWiFiHostname()                { return String("smuff-wi-esp"); }
+    String getWLStatusString()              { return String("WL_CONNECTED"); }
+};
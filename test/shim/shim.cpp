@@ -0,0 +1,56 @@
+/*
+ * Host implementations of the Arduino functions and objects declared in
+ * the shim's headers.
+ */
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+#include <LittleFS.h>
+#include <ESP8266WebServer.h>
+#include <ESP8266mDNS.h>
+#include <ESP8266NetBIOS.h>
+#include <WebSocketsServer.h>
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+HardwareSerial  Serial(0);
+HardwareSerial  Serial1(1);
+EspClass        ESP;
+WiFiClass       WiFi;
+MDNSClass       MDNS;
+NBNSClass       NBNS;
+UpdaterClass    Update;
+fs::FS          LittleFS;
+uint32_t        _FS_start, _FS_end;
+WebSocketsServerCore* WebSocketsServerCore::hostServer = nullptr;
+
+unsigned long millis() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+void esp_yield() {
+    yield();
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+
+int digitalRead(uint8_t) {
+    return HIGH;
+}